@@ -0,0 +1,181 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Compact variable-length encoding of a crash record
+ *
+ * Layout, fields in order, each present only when its flag bit is set:
+ *   flags        bits 7..5 version, see kCodecFlag... for bits 4..0
+ *   reason       varint, always present
+ *   seq          varint
+ *   uptime       varint
+ *   exccause     varint
+ *   epc1         varint, (offset << 2) | region
+ *   flags2       present with kCodecFlagOomOrGasp, see kCodecFlag2...
+ *   oom          varint
+ *   gasp         length byte followed by the characters
+ */
+#include "AbendCodec.h"
+#include <string.h>
+
+constexpr uint8_t kCodecVersion       = 1u << 5;
+constexpr uint8_t kCodecVersionMask   = 7u << 5;
+constexpr uint8_t kCodecFlagSeq       = 1u << 0;
+constexpr uint8_t kCodecFlagUptime    = 1u << 1;
+constexpr uint8_t kCodecFlagExccause  = 1u << 2;
+constexpr uint8_t kCodecFlagEpc1      = 1u << 3;
+constexpr uint8_t kCodecFlagOomOrGasp = 1u << 4;  // followed by a byte of flags
+
+// Second flags byte, only present with kCodecFlagOomOrGasp
+constexpr uint8_t kCodecFlag2Oom  = 1u << 0;
+constexpr uint8_t kCodecFlag2Gasp = 1u << 1;
+
+/*
+  Code address regions. Offsets in IRAM and ICACHE are small compared to the
+  full 32-bit address.
+    XCHAL_INSTRAM0_VADDR 0x40000000 Boot ROM
+    XCHAL_INSTRAM1_VADDR 0x40100000 IRAM
+    XCHAL_INSTROM0_VADDR 0x40200000 ICACHE, flash
+*/
+constexpr uint32_t kRegionBase[] = { 0x40000000u, 0x40100000u, 0x40200000u };
+constexpr uint32_t kRegionSize   = 0x100000u;
+constexpr uint32_t kRegionRaw    = 3u;
+
+struct CodecWriter {
+    uint8_t *p;
+    uint8_t *end;
+    bool ok;
+
+    inline void byte(uint8_t b) {
+        if (p < end) {
+            *p++ = b;
+        } else {
+            ok = false;
+        }
+    }
+    inline void varint(uint32_t v) {
+        while (v >= 0x80u) {
+            byte((uint8_t)(v | 0x80u));
+            v >>= 7;
+        }
+        byte((uint8_t)v);
+    }
+};
+
+struct CodecReader {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok;
+
+    inline uint8_t byte(void) {
+        if (p < end) return *p++;
+        ok = false;
+        return 0;
+    }
+    inline uint32_t varint(void) {
+        uint32_t v = 0;
+        for (uint32_t shift = 0; shift < 35; shift += 7) {
+            uint8_t b = byte();
+            v |= (uint32_t)(b & 0x7fu) << shift;
+            if (0 == (b & 0x80u)) return v;
+        }
+        ok = false;     // More than 5 bytes
+        return 0;
+    }
+};
+
+static uint32_t packAddress(uint32_t addr) {
+    for (uint32_t region = 0; region < kRegionRaw; region++) {
+        uint32_t offset = addr - kRegionBase[region];
+        if (offset < kRegionSize) return (offset << 2) | region;
+    }
+    return kRegionRaw;
+}
+
+size_t abendCodecEncode(const AbendCodecRecord *rec, uint8_t *buf, size_t len) {
+    size_t gasp_len = strnlen(rec->gasp, sizeof(rec->gasp) - 1);
+    uint8_t flags = kCodecVersion;
+    if (rec->seq)       flags |= kCodecFlagSeq;
+    if (rec->uptime)    flags |= kCodecFlagUptime;
+    if (rec->exccause)  flags |= kCodecFlagExccause;
+    if (rec->epc1)      flags |= kCodecFlagEpc1;
+    uint8_t flags2 = 0;
+    if (rec->oom)       flags2 |= kCodecFlag2Oom;
+    if (gasp_len)       flags2 |= kCodecFlag2Gasp;
+    if (flags2)         flags |= kCodecFlagOomOrGasp;
+
+    CodecWriter w = { buf, buf + len, true };
+    w.byte(flags);
+    w.varint(rec->reason);
+    if (flags & kCodecFlagSeq)      w.varint(rec->seq);
+    if (flags & kCodecFlagUptime)   w.varint(rec->uptime);
+    if (flags & kCodecFlagExccause) w.varint(rec->exccause);
+    if (flags & kCodecFlagEpc1) {
+        uint32_t packed = packAddress(rec->epc1);
+        if (kRegionRaw == packed) {
+            w.byte((uint8_t)packed);
+            for (size_t i = 0; i < 4; i++) w.byte((uint8_t)(rec->epc1 >> (i * 8)));
+        } else {
+            w.varint(packed);
+        }
+    }
+    if (flags2) {
+        w.byte(flags2);
+        if (flags2 & kCodecFlag2Oom) w.varint(rec->oom);
+        if (flags2 & kCodecFlag2Gasp) {
+            w.byte((uint8_t)gasp_len);
+            if (w.ok && (size_t)(w.end - w.p) >= gasp_len) {
+                memcpy(w.p, rec->gasp, gasp_len);
+                w.p += gasp_len;
+            } else {
+                w.ok = false;
+            }
+        }
+    }
+    return (w.ok) ? (size_t)(w.p - buf) : 0;
+}
+
+size_t abendCodecDecode(const uint8_t *buf, size_t len, AbendCodecRecord *rec) {
+    memset(rec, 0, sizeof(AbendCodecRecord));
+    CodecReader r = { buf, buf + len, true };
+    uint8_t flags = r.byte();
+    if (kCodecVersion != (flags & kCodecVersionMask)) return 0;
+    rec->reason = r.varint();
+    if (flags & kCodecFlagSeq)      rec->seq      = r.varint();
+    if (flags & kCodecFlagUptime)   rec->uptime   = r.varint();
+    if (flags & kCodecFlagExccause) rec->exccause = r.varint();
+    if (flags & kCodecFlagEpc1) {
+        uint32_t packed = r.varint();
+        uint32_t region = packed & 3u;
+        if (kRegionRaw == region) {
+            if (kRegionRaw != packed) return 0;
+            for (size_t i = 0; i < 4; i++) rec->epc1 |= (uint32_t)r.byte() << (i * 8);
+        } else {
+            rec->epc1 = kRegionBase[region] + (packed >> 2);
+        }
+    }
+    if (flags & kCodecFlagOomOrGasp) {
+        uint8_t flags2 = r.byte();
+        if (flags2 & kCodecFlag2Oom) rec->oom = r.varint();
+        if (flags2 & kCodecFlag2Gasp) {
+            size_t gasp_len = r.byte();
+            if (gasp_len >= sizeof(rec->gasp) || (size_t)(r.end - r.p) < gasp_len) return 0;
+            memcpy(rec->gasp, r.p, gasp_len);
+            rec->gasp[gasp_len] = '\0';
+            r.p += gasp_len;
+        }
+    }
+    return (r.ok) ? (size_t)(r.p - buf) : 0;
+}
@@ -0,0 +1,64 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Compact variable-length encoding of a crash record
+ *
+ * Summary:
+ *   * Leading flags byte, upper 3 bits hold the encoding version, lower bits
+ *     flag which optional fields follow. Zero valued fields are omitted.
+ *   * Counters use unsigned LEB128 varints, 7 bits per byte.
+ *   * Code addresses are encoded as a varint of (offset << 2 | region), the
+ *     offset is relative to the Boot ROM, IRAM or ICACHE base. Others are
+ *     stored as a raw 32-bit value in region 3.
+ *   * gasp text is length-prefixed, no terminating NUL.
+ *
+ * A typical Exception record is 8 - 10 bytes and an SDK panic with a short
+ * last gasp message is about 20 bytes. Encoded records are self-delimiting
+ * and can be concatenated. Many fit in the 512 bytes of RTC user memory.
+ *
+ * No Arduino dependencies; used on the device and on a Linux host, see
+ * tools/abendcodec.cpp.
+ */
+#ifndef ABENDCODEC_H_
+#define ABENDCODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef ABENDINFO_CODEC_GASP_MAX
+#define ABENDINFO_CODEC_GASP_MAX 64
+#endif
+
+// Decoded form of a record
+struct AbendCodecRecord {
+    uint32_t seq;
+    uint32_t uptime;    // in seconds
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t oom;
+    char     gasp[ABENDINFO_CODEC_GASP_MAX];    // NUL terminated
+};
+
+// Worst case encoded size, all fields present at full width.
+constexpr size_t kAbendCodecMaxSize = 1 + 5 * 5 + 1 + 5 + 1 + ABENDINFO_CODEC_GASP_MAX - 1;
+
+// Returns the number of bytes written or 0 when buf is too small.
+size_t abendCodecEncode(const AbendCodecRecord *rec, uint8_t *buf, size_t len);
+// Returns the number of bytes consumed or 0 for a malformed or truncated record.
+size_t abendCodecDecode(const uint8_t *buf, size_t len, AbendCodecRecord *rec);
+
+#endif // ABENDCODEC_H_
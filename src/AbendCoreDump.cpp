@@ -0,0 +1,256 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * DRAM core dump to reserved flash sectors
+ *
+ * Called from the custom crash callback. The selected DRAM regions are copied
+ * through a small static buffer and written to flash sectors erased before the
+ * crash, see AbendCoreDump.h for the layout. There is no erase on the crash
+ * path, only page writes. The dump stops at ABENDINFO_COREDUMP_BUDGET_MS,
+ * measured with the CPU cycle count, keeping well inside the HW WDT timeout.
+ * The cycles spent are saved in the header for a throughput figure.
+ *
+ * With ABENDINFO_COREDUMP_COMPRESS each segment is compressed with AbendLz
+ * on the way to flash. Compression costs CPU time, but there are fewer
+ * bytes to write.
+ *
+ * A region holding a dump, complete or not, is not written again until
+ * abendCoreDumpErase() is called. The first crash of a series is kept.
+ */
+#include "Arduino.h"
+#include <user_interface.h>
+#include <spi_flash.h>
+#include <cont.h>
+#include "AbendInfo.h"
+#if ABENDINFO_COREDUMP_COMPRESS
+#include "AbendLz.h"
+#endif
+
+#if ABENDINFO_OPTION && ABENDINFO_COREDUMP
+
+#pragma GCC optimize("Os")
+
+extern "C" {
+extern char _data_start[];
+extern char _bss_end[];
+extern char _heap_start[];
+extern uint32_t ets_get_cpu_frequency(void);
+}
+
+static_assert(0 == ABENDINFO_COREDUMP_ADDR % SPI_FLASH_SEC_SIZE, "ABENDINFO_COREDUMP_ADDR must be sector aligned");
+static_assert(0 == ABENDINFO_COREDUMP_BUFFER % 4 && ABENDINFO_COREDUMP_BUFFER >= 64);
+
+constexpr uint32_t kCoreDumpSize = ABENDINFO_COREDUMP_SECTORS * SPI_FLASH_SEC_SIZE;
+constexpr uint32_t kHeapEnd = 0x3fffc000u;     // umm_malloc heap ends at the SDK's data
+constexpr uint32_t kDramEnd = 0x40000000u;
+
+static uint32_t coreDumpBuffer[ABENDINFO_COREDUMP_BUFFER / 4];
+#if ABENDINFO_COREDUMP_COMPRESS
+static AbendLzEncoder coreDumpLz;
+static uint32_t coreDumpTail[kAbendLzOutSize / 4];
+#else
+static uint32_t coreDumpTail[1];
+#endif
+
+static bool flashRead(uint32_t ofs, void *buf, size_t len) {
+    return SPI_FLASH_RESULT_OK == spi_flash_read(ABENDINFO_COREDUMP_ADDR + ofs, (uint32_t *)buf, len);
+}
+
+static bool flashWrite(uint32_t ofs, const void *buf, size_t len) {
+    return SPI_FLASH_RESULT_OK == spi_flash_write(ABENDINFO_COREDUMP_ADDR + ofs, (uint32_t *)buf, len);
+}
+
+// Destination of segment data, emitted in blocks that are a multiple of 4
+// bytes except for the last block of a compressed segment.
+struct CoreDumpOut {
+    uint32_t ofs;       // next flash offset within the region
+    uint32_t flags;     // kAbendCoreDumpOutOfSpace
+};
+
+static bool coreDumpEmit(void *ctx, const uint8_t *buf, size_t len) {
+    CoreDumpOut *out = (CoreDumpOut *)ctx;
+    size_t padded = (len + 3u) & ~3u;
+    if (out->ofs + padded > kCoreDumpSize) {
+        out->flags |= kAbendCoreDumpOutOfSpace;
+        return false;
+    }
+    if (padded != len) {
+        // Last block of a compressed segment
+        memset(coreDumpTail, 0xff, sizeof(coreDumpTail));
+        memcpy(coreDumpTail, buf, len);
+        buf = (const uint8_t *)coreDumpTail;
+    }
+    if (! flashWrite(out->ofs, buf, padded)) return false;
+    out->ofs += len;
+    return true;
+}
+
+static void addSegment(AbendCoreDumpHeader& hdr, uint32_t start, uint32_t end) {
+    start &= ~3u;
+    end = (end + 3u) & ~3u;
+    if (start >= end || hdr.count >= kAbendCoreDumpSegments) return;
+    for (size_t i = 0; i < hdr.count; i++) {
+        const AbendCoreDumpSegment& s = hdr.segment[i];
+        if (start >= s.addr && end <= s.addr + s.size) return;    // already covered
+    }
+    hdr.segment[hdr.count].addr = start;
+    hdr.segment[hdr.count].size = end - start;
+    hdr.count++;
+}
+
+void abendCoreDumpWrite(struct rst_info *rst_info, uint32_t stack, uint32_t stack_end) {
+    uint32_t state = 0;
+    if (! flashRead(0, &state, sizeof(state)) || kAbendCoreDumpBlank != state) return;
+    state = kAbendCoreDumpWriting;
+    if (! flashWrite(0, &state, sizeof(state))) return;
+
+    AbendCoreDumpHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic     = ABENDCOREDUMP_MAGIC;
+    hdr.version   = ABENDCOREDUMP_VERSION;
+    hdr.cpu_mhz   = ets_get_cpu_frequency();
+    hdr.reason    = rst_info->reason;
+    hdr.exccause  = rst_info->exccause;
+    hdr.epc1      = rst_info->epc1;
+    hdr.excvaddr  = rst_info->excvaddr;
+    hdr.stack     = stack;
+    hdr.stack_end = stack_end;
+    __asm__ __volatile__("rsr.excsave1 %[pc]\n\t" : [pc]"=r"(hdr.excsave1) :: "memory");
+
+    // Larger regions first, a crash stack inside one of them is not repeated.
+    if (ABENDINFO_COREDUMP_REGIONS & ABENDINFO_COREDUMP_SYS) {
+        addSegment(hdr, kHeapEnd, kDramEnd);
+    }
+    if (ABENDINFO_COREDUMP_REGIONS & ABENDINFO_COREDUMP_HEAP) {
+        addSegment(hdr, (uint32_t)_heap_start, kHeapEnd);
+    }
+    if (ABENDINFO_COREDUMP_REGIONS & ABENDINFO_COREDUMP_DATA) {
+        addSegment(hdr, (uint32_t)_data_start, (uint32_t)_bss_end);
+    }
+    if (ABENDINFO_COREDUMP_REGIONS & ABENDINFO_COREDUMP_STACKS) {
+        if (g_pcont) addSegment(hdr, (uint32_t)g_pcont, (uint32_t)g_pcont + sizeof(cont_t));
+        addSegment(hdr, stack, stack_end);
+    }
+
+    const uint32_t budget = ABENDINFO_COREDUMP_BUDGET_MS * 1000u * hdr.cpu_mhz;
+    const uint32_t start = esp_get_cycle_count();
+    CoreDumpOut out = { kAbendCoreDumpDataOffset, 0 };
+#if ABENDINFO_COREDUMP_COMPRESS
+    hdr.flags |= kAbendCoreDumpCompressed;
+#endif
+    for (size_t i = 0; i < hdr.count; i++) {
+        AbendCoreDumpSegment& s = hdr.segment[i];
+        const uint8_t *src = (const uint8_t *)s.addr;
+        const uint32_t size = s.size;
+        s.offset = out.ofs;
+        s.size   = 0;
+#if ABENDINFO_COREDUMP_COMPRESS
+        abendLzInit(&coreDumpLz, coreDumpEmit, &out);
+#endif
+        while (s.size < size && 0 == out.flags) {
+            uint32_t len = size - s.size;
+            if (len > sizeof(coreDumpBuffer)) len = sizeof(coreDumpBuffer);
+            if (esp_get_cycle_count() - start > budget) {
+                out.flags |= kAbendCoreDumpOutOfTime;
+                break;
+            }
+            memcpy(coreDumpBuffer, &src[s.size], len);
+#if ABENDINFO_COREDUMP_COMPRESS
+            if (! abendLzWrite(&coreDumpLz, coreDumpBuffer, len)) break;
+#else
+            if (! coreDumpEmit(&out, (const uint8_t *)coreDumpBuffer, len)) break;
+#endif
+            s.size += len;
+        }
+#if ABENDINFO_COREDUMP_COMPRESS
+        // Input accepted by the encoder is in the stream once it is finished
+        abendLzFinish(&coreDumpLz);
+        s.stored = coreDumpLz.total_out;
+        if (out.flags & kAbendCoreDumpOutOfSpace) s.size = 0;
+        out.ofs = (out.ofs + 3u) & ~3u;
+#else
+        s.stored = s.size;
+#endif
+        hdr.size += s.size;
+        if (s.size < size) {
+            hdr.count = i + 1;
+            break;
+        }
+    }
+    hdr.flags |= out.flags;
+    hdr.cycles = esp_get_cycle_count() - start;
+    hdr.crc = crc32(&hdr.magic, offsetof(struct AbendCoreDumpHeader, crc) - offsetof(struct AbendCoreDumpHeader, magic));
+
+    // Header after the data, the state word last
+    if (! flashWrite(4, &hdr.magic, sizeof(hdr) - 4)) return;
+    state = kAbendCoreDumpComplete;
+    flashWrite(0, &state, sizeof(state));
+}
+
+bool abendCoreDumpHeader(AbendCoreDumpHeader *hdr) {
+    if (! flashRead(0, hdr, sizeof(AbendCoreDumpHeader))) return false;
+    return kAbendCoreDumpComplete == hdr->state &&
+           ABENDCOREDUMP_MAGIC == hdr->magic &&
+           hdr->crc == crc32(&hdr->magic, offsetof(struct AbendCoreDumpHeader, crc) - offsetof(struct AbendCoreDumpHeader, magic));
+}
+
+bool abendCoreDumpErase(void) {
+    for (uint32_t i = 0; i < ABENDINFO_COREDUMP_SECTORS; i++) {
+        if (SPI_FLASH_RESULT_OK != spi_flash_erase_sector(ABENDINFO_COREDUMP_ADDR / SPI_FLASH_SEC_SIZE + i)) return false;
+        yield();
+    }
+    return true;
+}
+
+void abendInfoCoreDumpReport(Print& sio) {
+    AbendCoreDumpHeader hdr;
+    // Left zero, neither state, when the flash read fails
+    memset(&hdr, 0, sizeof(hdr));
+    if (! abendCoreDumpHeader(&hdr)) {
+        if (kAbendCoreDumpWriting == hdr.state) {
+            sio.printf_P(PSTR("\r\nCore Dump: incomplete, erase to rearm\r\n"));
+        } else if (kAbendCoreDumpBlank == hdr.state) {
+            sio.printf_P(PSTR("\r\nCore Dump: ready, %u KB at 0x%06x\r\n"), kCoreDumpSize / 1024u, ABENDINFO_COREDUMP_ADDR);
+        }
+        return;
+    }
+    sio.printf_P(PSTR("\r\nCore Dump: at 0x%06x, EXCCAUSE %u @0x%08x\r\n"),
+        ABENDINFO_COREDUMP_ADDR, hdr.exccause, hdr.epc1);
+    for (size_t i = 0; i < hdr.count && i < kAbendCoreDumpSegments; i++) {
+        const AbendCoreDumpSegment& s = hdr.segment[i];
+        sio.printf_P(PSTR("  0x%08x - 0x%08x  %6u bytes at +0x%05x"),
+            s.addr, s.addr + s.size, s.size, s.offset);
+        if (hdr.flags & kAbendCoreDumpCompressed) {
+            sio.printf_P(PSTR(", %u stored"), s.stored);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+    if (hdr.flags & kAbendCoreDumpOutOfTime) {
+        sio.printf_P(PSTR("  Stopped at the %u ms time budget\r\n"), ABENDINFO_COREDUMP_BUDGET_MS);
+    }
+    if (hdr.flags & kAbendCoreDumpOutOfSpace) {
+        sio.printf_P(PSTR("  Stopped, region full\r\n"));
+    }
+    if (hdr.cycles && hdr.cpu_mhz) {
+        // bytes per ms = size / (cycles / (mhz * 1000))
+        uint32_t us = hdr.cycles / hdr.cpu_mhz;
+        uint32_t kb_per_ms_x100 = (uint32_t)((uint64_t)hdr.size * 100000u / 1024u / (us ? us : 1u));
+        sio.printf_P(PSTR("  %u bytes in %u.%03u ms, %u.%02u KB/ms\r\n"),
+            hdr.size, us / 1000u, us % 1000u, kb_per_ms_x100 / 100u, kb_per_ms_x100 % 100u);
+    }
+}
+
+#endif // ABENDINFO_OPTION && ABENDINFO_COREDUMP
@@ -0,0 +1,82 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Layout of a DRAM core dump in a reserved flash region
+ *
+ * Summary:
+ *   * The first 256 bytes of the region hold the header and segment table.
+ *     Segment data follows, each segment at the offset given in the table.
+ *   * The region is erased before use. The dump is written from the crash
+ *     callback without erasing, NOR flash writes only clear bits.
+ *   * With kAbendCoreDumpCompressed each segment is a separate AbendLz
+ *     stream, see AbendLz.h, of `stored` bytes. Flash offsets stay 4-byte
+ *     aligned.
+ *   * state is the first word written and the last one updated. Blank means
+ *     the region is ready, Writing marks a dump that did not finish, Complete
+ *     marks a finished dump with a valid header.
+ *
+ * No Arduino dependencies; used on the device and on a Linux host.
+ */
+#ifndef ABENDCOREDUMP_H_
+#define ABENDCOREDUMP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ABENDCOREDUMP_MAGIC   0x504d4443u   // "CDMP"
+#define ABENDCOREDUMP_VERSION 2
+
+constexpr uint32_t kAbendCoreDumpBlank    = 0xffffffffu;
+constexpr uint32_t kAbendCoreDumpWriting  = 0x54495257u;    // "WRIT"
+constexpr uint32_t kAbendCoreDumpComplete = kAbendCoreDumpWriting & 0x0000ffffu;
+constexpr uint32_t kAbendCoreDumpDataOffset = 256u;
+constexpr size_t   kAbendCoreDumpSegments = 8u;
+
+// flags
+constexpr uint32_t kAbendCoreDumpOutOfTime  = 1u << 0;  // Stopped at the time budget
+constexpr uint32_t kAbendCoreDumpOutOfSpace = 1u << 1;  // Region too small
+constexpr uint32_t kAbendCoreDumpCompressed = 1u << 2;  // Segment data is AbendLz compressed
+
+struct AbendCoreDumpSegment {
+    uint32_t addr;      // DRAM address
+    uint32_t size;      // bytes of DRAM captured, a multiple of 4
+    uint32_t offset;    // from the start of the region
+    uint32_t stored;    // bytes in flash, less than size when compressed
+};
+
+struct AbendCoreDumpHeader {
+    uint32_t state;     // kAbendCoreDump...
+    uint32_t magic;     // ABENDCOREDUMP_MAGIC
+    uint16_t version;   // ABENDCOREDUMP_VERSION
+    uint16_t count;     // segments used
+    uint32_t flags;
+    uint32_t size;      // bytes of DRAM captured, all segments
+    uint32_t cycles;    // CPU cycles spent writing segment data
+    uint32_t cpu_mhz;
+    // From the crash callback
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t excvaddr;
+    uint32_t excsave1;
+    uint32_t stack;     // Stack pointer and end of stack at Postmortem
+    uint32_t stack_end;
+    AbendCoreDumpSegment segment[kAbendCoreDumpSegments];
+    uint32_t crc;       // Must be last element, covers magic ... segment
+};
+static_assert(sizeof(AbendCoreDumpHeader) <= kAbendCoreDumpDataOffset, "header must fit in the first 256 bytes");
+
+#endif // ABENDCOREDUMP_H_
@@ -0,0 +1,496 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Recoverable exception statistics
+ *
+ * Exceptions with a C handler, eg. the core's LoadStoreError handler for byte
+ * access to IRAM and flash, are entered through the ROM's C wrapper in
+ * _xtos_exc_handler_table and the handler in _xtos_c_handler_table. With
+ * ABENDINFO_EXC_STATS each such handler is replaced by a thin wrapper that
+ * counts calls and the CPU cycles spent in the original handler. The ROM
+ * wrapper's register save and restore is not included.
+ *
+ * Causes left with the SDK's fatal handler are not wrapped, a crash is
+ * reported by the Postmortem. A handler installed after abendHandlerInstall()
+ * is not counted until abendExcStatsInstall() runs again.
+ *
+ * With ABENDINFO_UNALIGNED, EXCCAUSE 9 gets a handler that emulates the
+ * unaligned l16ui, l16si, l32i, l32i.n, s16i, s32i, and s32i.n that caused it
+ * with aligned 32-bit accesses, then steps over the instruction. Faulting PCs
+ * are counted in a small table of hot sites. Anything else, or an address
+ * outside DRAM, IRAM, flash, or ROM, goes to the C handler cause 9 had before,
+ * usually the SDK's fatal handler. A handler at the level of the exception
+ * table, not through the ROM C wrapper, is left in place.
+ *
+ * The same load/store decoder describes the access of a crash with
+ * ABENDINFO_FAULT_ACCESS, see abendFaultDescribe().
+ *
+ * With ABENDINFO_EXC_FRAME, causes routed to the SDK's fatal handler pass
+ * through excFrameHandler() first. It copies the exception frame and the
+ * exception special registers into .noinit, before the SDK or Postmortem
+ * run. The crash callback completes it with the stack pointer. A frame that
+ * was never completed is from a crash that ended in a HW WDT reset.
+ * Breakpoints, eg. BP, are taken by the debug vector, not through
+ * _xtos_exc_handler_table, no frame is captured for them.
+ *
+ * Both handlers call the SDK's fatal handler from their own frame. The
+ * Postmortem's stack pointer, a fixed offset from its own, is then below the
+ * stack of the exception by that frame. abendExcStack() gives the crash
+ * callback the stack pointer of the exception, from the exception frame.
+ */
+#include "Arduino.h"
+#include <ets_sys.h> // ets_get_cpu_frequency
+#include <esp8266_undocumented.h>
+#include "AbendInfo.h"
+
+#if ABENDINFO_OPTION && (ABENDINFO_EXC_STATS || ABENDINFO_UNALIGNED || ABENDINFO_FAULT_ACCESS || ABENDINFO_EXC_FRAME)
+
+#pragma GCC optimize("Os")
+
+#if ABENDINFO_UNALIGNED || ABENDINFO_FAULT_ACCESS
+// Code memory is read a word at a time
+IRAM_ATTR uint32_t abendFetchInsn(uint32_t pc) {
+    const uint32_t *p = (const uint32_t *)(pc & ~3u);
+    const uint32_t shift = (pc & 3u) * 8u;
+    uint32_t insn = p[0] >> shift;
+    if (shift > 8u) {
+        insn |= p[1] << (32u - shift);
+    }
+    return insn;
+}
+
+IRAM_ATTR bool abendDecodeAccess(uint32_t insn, AbendAccess *a) {
+    insn &= 0x00ffffffu;
+    a->width  = 0;
+    a->store  = false;
+    a->sign   = false;
+    a->reg    = (insn >> 4) & 0x0fu;
+    a->base   = (insn >> 8) & 0x0fu;
+    a->len    = 3;
+    a->offset = (insn >> 16) & 0xffu;
+    switch (insn & 0x0fu) {
+        case 1:     // l32r, pc relative literal
+            a->width  = 4;
+            a->base   = kAbendAccessLiteral;
+            a->offset = (int32_t)(0xfffc0000u | ((insn >> 8) << 2));
+            break;
+        case 2:     // RRI8 load/store group
+            switch ((insn >> 12) & 0x0fu) {
+                case 0x0: a->width = 1; break;                      // l8ui
+                case 0x1: a->width = 2; break;                      // l16ui
+                case 0x2: a->width = 4; break;                      // l32i
+                case 0x4: a->width = 1; a->store = true; break;     // s8i
+                case 0x5: a->width = 2; a->store = true; break;     // s16i
+                case 0x6: a->width = 4; a->store = true; break;     // s32i
+                case 0x9: a->width = 2; a->sign = true; break;      // l16si
+                case 0xb: a->width = 4; break;                      // l32ai
+                case 0xf: a->width = 4; a->store = true; break;     // s32ri
+            }
+            a->offset *= a->width;
+            break;
+        case 8:     // l32i.n
+        case 9:     // s32i.n
+            a->width  = 4;
+            a->store  = (9u == (insn & 0x0fu));
+            a->len    = 2;
+            a->offset = ((insn >> 12) & 0x0fu) * 4;
+            break;
+    }
+    return 0 != a->width;
+}
+#endif // ABENDINFO_UNALIGNED || ABENDINFO_FAULT_ACCESS
+
+#if ABENDINFO_FAULT_ACCESS
+size_t abendFaultDescribe(uint32_t insn, uint32_t pc, uint32_t excvaddr, char *buf, size_t size) {
+    AbendAccess a;
+    if (0 == size || !abendDecodeAccess(insn, &a)) return 0;
+    int len;
+    if (kAbendAccessLiteral == a.base) {
+        const uint32_t literal = ((pc + 3u) & ~3u) + a.offset;
+        len = snprintf_P(buf, size, PSTR("32-bit load from 0x%08x via literal 0x%08x"), excvaddr, literal);
+    } else {
+        len = snprintf_P(buf, size, PSTR("%u-bit %S%S 0x%08x via a%u+%d"),
+            a.width * 8u, (a.sign) ? PSTR("signed ") : PSTR(""),
+            (a.store) ? PSTR("store to") : PSTR("load from"), excvaddr, a.base, (int)a.offset);
+    }
+    return (len > 0) ? strnlen(buf, size) : 0;
+}
+#endif
+
+#if ABENDINFO_UNALIGNED || ABENDINFO_EXC_FRAME
+// Stack the exception vector reserves, the exception frame is at its base
+constexpr uint32_t kExcVectorStack = 256u;
+
+// Stack pointer of the exception passed to the SDK's fatal handler, 0 for none
+static uint32_t excFatalSp;
+
+static IRAM_ATTR void excFatal(fn_c_exception_handler_t fatal, struct __exception_frame *ef, int cause) {
+    excFatalSp = (uint32_t)ef + kExcVectorStack;
+    fatal(ef, cause);
+    // A chained handler that returned handled the exception
+    excFatalSp = 0;
+}
+
+uint32_t abendExcStack(uint32_t stack) {
+    return (excFatalSp) ? excFatalSp : stack;
+}
+#endif
+
+#if ABENDINFO_EXC_FRAME
+constexpr uint32_t kExcFrameCaptured = 0x46435845u;    // "EXCF"
+constexpr uint32_t kExcFrameComplete = 0x46435843u;    // "CXCF"
+
+AbendExcFrame abendExcFrame __attribute__((section(".noinit")));
+static AbendExcFrame resetExcFrame __attribute__((section(".noinit")));
+static fn_c_exception_handler_t excFrameFatal;
+
+static IRAM_ATTR void excFrameHandler(struct __exception_frame *ef, int cause) {
+    AbendExcFrame& f = abendExcFrame;
+    // The first fault is kept, not one in the SDK's handling of it.
+    if (0 == f.magic) {
+        f.cause = cause;
+        f.epc1  = ef->epc;
+        f.ps    = ef->ps;
+        f.sar   = ef->sar;
+        asm volatile(
+            "rsr.excvaddr %[excvaddr]\n\t"
+            "rsr.excsave1 %[excsave1]\n\t"
+            "rsr.epc2     %[epc2]\n\t"
+            "rsr.epc3     %[epc3]\n\t"
+            "rsr.depc     %[depc]\n\t"
+            : [excvaddr]"=&r"(f.excvaddr), [excsave1]"=&r"(f.excsave1),
+              [epc2]"=&r"(f.epc2), [epc3]"=&r"(f.epc3), [depc]"=&r"(f.depc)
+            :: "memory");
+        // The frame has no a1, it is the top of the stack the vector reserved
+        const uint32_t *a = &ef->a0;
+        f.a[0] = a[0];
+        f.a[1] = (uint32_t)ef + kExcVectorStack;
+        for (size_t i = 2; i < 16u; i++) {
+            f.a[i] = a[i - 1u];
+        }
+        f.stack = f.stack_end = 0;
+        f.magic = kExcFrameCaptured;
+    }
+    excFatal(excFrameFatal, ef, cause);
+}
+
+void abendExcFrameInit(uint32_t reason) {
+    if (isNoinitHeld(reason) && (kExcFrameCaptured == abendExcFrame.magic || kExcFrameComplete == abendExcFrame.magic)) {
+        resetExcFrame = abendExcFrame;
+    } else {
+        resetExcFrame.magic = 0;
+    }
+    abendExcFrame.magic = 0;
+}
+
+void abendExcFrameInstall(void) {
+    // Causes that reach the SDK's fatal handler through the ROM C wrapper, as
+    // set up by abendHandlerInstall() for cause 20.
+    const _xtos_handler c_wrapper = _xtos_exc_handler_table[20];
+    const fn_c_exception_handler_t fatal = _xtos_c_handler_table[20];
+    if (excFrameHandler == fatal) return;
+    excFrameFatal = fatal;
+    for (size_t cause = 0; cause < 64u; cause++) {
+        if (c_wrapper == _xtos_exc_handler_table[cause] && fatal == _xtos_c_handler_table[cause]) {
+            _xtos_set_exception_handler(cause, excFrameHandler);
+        }
+    }
+}
+
+void abendExcFrameSeal(uint32_t stack, uint32_t stack_end) {
+    AbendExcFrame& f = abendExcFrame;
+    if (kExcFrameCaptured == f.magic) {
+        f.stack     = stack;
+        f.stack_end = stack_end;
+        f.magic     = kExcFrameComplete;
+    }
+}
+
+void abendInfoExcFrameReport(Print& sio) {
+    const AbendExcFrame& f = resetExcFrame;
+    if (kExcFrameCaptured != f.magic && kExcFrameComplete != f.magic) return;
+    sio.printf_P(PSTR("\r\nException Frame: (EXCCAUSE %u)\r\n"), f.cause);
+    if (kExcFrameCaptured == f.magic) {
+        sio.printf_P(PSTR("  crash callback did not run, HW WDT reset\r\n"));
+    }
+    sio.printf_P(PSTR("  epc1=0x%08x ps=0x%08x sar=0x%08x excvaddr=0x%08x\r\n"),
+        f.epc1, f.ps, f.sar, f.excvaddr);
+    sio.printf_P(PSTR("  epc2=0x%08x epc3=0x%08x depc=0x%08x excsave1=0x%08x\r\n"),
+        f.epc2, f.epc3, f.depc, f.excsave1);
+    for (size_t i = 0; i < 16u; i += 4) {
+        sio.printf_P(PSTR("  a%-2u=0x%08x a%-2u=0x%08x a%-2u=0x%08x a%-2u=0x%08x\r\n"),
+            i, f.a[i], i + 1u, f.a[i + 1u], i + 2u, f.a[i + 2u], i + 3u, f.a[i + 3u]);
+    }
+    if (f.stack) {
+        sio.printf_P(PSTR("  stack 0x%08x ... 0x%08x\r\n"), f.stack, f.stack_end);
+    }
+}
+#endif // ABENDINFO_EXC_FRAME
+
+#if ABENDINFO_EXC_STATS
+struct ExcSlot {
+    fn_c_exception_handler_t handler;   // original C handler
+    uint32_t cause;
+    uint32_t count;
+    uint32_t cycles_max;
+    uint64_t cycles;
+};
+
+static uint8_t excSlotOf[64];           // slot + 1, 0 for a cause not wrapped
+static ExcSlot excSlot[ABENDINFO_EXC_STATS];
+static size_t  excSlots;
+
+static IRAM_ATTR void excCountHandler(struct __exception_frame *ef, int cause) {
+    ExcSlot& s = excSlot[excSlotOf[cause & 63] - 1u];
+    const uint32_t start = esp_get_cycle_count();
+    s.handler(ef, cause);
+    const uint32_t cycles = esp_get_cycle_count() - start;
+    s.count++;
+    s.cycles += cycles;
+    if (cycles > s.cycles_max) {
+        s.cycles_max = cycles;
+    }
+}
+
+void abendExcStatsInstall(void) {
+    // abendHandlerInstall() routes cause 20 to the SDK's fatal handler through
+    // the ROM C wrapper. Only causes entered through the same wrapper have a
+    // C handler to wrap.
+    const _xtos_handler c_wrapper = _xtos_exc_handler_table[20];
+    const fn_c_exception_handler_t fatal = _xtos_c_handler_table[20];
+    uint32_t save_ps = xt_rsil(15);
+    for (size_t cause = 0; cause < 64u; cause++) {
+        const fn_c_exception_handler_t handler = _xtos_c_handler_table[cause];
+        if (c_wrapper != _xtos_exc_handler_table[cause] ||
+            NULL == handler || fatal == handler || excCountHandler == handler) {
+            continue;
+        }
+        size_t slot = excSlotOf[cause];
+        if (0 == slot) {
+            if (ABENDINFO_EXC_STATS == excSlots) break;
+            slot = ++excSlots;
+            excSlot[slot - 1u].cause = cause;
+            excSlotOf[cause] = slot;
+        }
+        excSlot[slot - 1u].handler = handler;
+        _xtos_set_exception_handler(cause, excCountHandler);
+    }
+    xt_wsr_ps(save_ps);
+}
+
+size_t abendExcStatsGet(AbendExcStats *stats, size_t n) {
+    size_t i = 0;
+    for (; i < n && i < excSlots; i++) {
+        uint32_t save_ps = xt_rsil(15);
+        const ExcSlot& s = excSlot[i];
+        stats[i].cause      = s.cause;
+        stats[i].count      = s.count;
+        stats[i].cycles_max = s.cycles_max;
+        stats[i].cycles     = s.cycles;
+        xt_wsr_ps(save_ps);
+    }
+    return i;
+}
+
+void abendExcStatsReset(void) {
+    for (size_t i = 0; i < excSlots; i++) {
+        uint32_t save_ps = xt_rsil(15);
+        excSlot[i].count = excSlot[i].cycles_max = 0;
+        excSlot[i].cycles = 0;
+        xt_wsr_ps(save_ps);
+    }
+}
+
+static PGM_P excCauseName(uint32_t cause) {
+    switch (cause) {
+        case 0:  return PSTR("IllegalInstruction");
+        case 2:  return PSTR("InstructionFetchError");
+        case 3:  return PSTR("LoadStoreError");
+        case 6:  return PSTR("IntegerDivideByZero");
+        case 9:  return PSTR("LoadStoreAlignment");
+        case 28: return PSTR("LoadProhibited");
+        case 29: return PSTR("StoreProhibited");
+        default: return PSTR("");
+    }
+}
+
+void abendInfoExcStatsReport(Print& sio) {
+    AbendExcStats stats[ABENDINFO_EXC_STATS];
+    const size_t n = abendExcStatsGet(stats, ABENDINFO_EXC_STATS);
+    sio.printf_P(PSTR("\r\nRecoverable Exceptions:\r\n"));
+    if (0 == n) {
+        sio.printf_P(PSTR("  no exception handlers wrapped\r\n"));
+        return;
+    }
+    const uint32_t mhz = ets_get_cpu_frequency();
+    // Share of the time since boot, in 1/100 %
+    const uint64_t up_cycles = (uint64_t)millis() * 1000u * mhz;
+    sio.printf_P(PSTR("  cause                        count    total ms  avg cyc  max cyc    CPU\r\n"));
+    for (size_t i = 0; i < n; i++) {
+        const AbendExcStats& s = stats[i];
+        const uint32_t ms  = (uint32_t)(s.cycles / (1000u * mhz));
+        const uint32_t avg = (s.count) ? (uint32_t)(s.cycles / s.count) : 0u;
+        const uint32_t bp  = (up_cycles) ? (uint32_t)(s.cycles * 10000u / up_cycles) : 0u;
+        sio.printf_P(PSTR("  %2u %-22S %10u %11u %8u %8u %3u.%02u%%\r\n"),
+            s.cause, excCauseName(s.cause), s.count, ms, avg, s.cycles_max, bp / 100u, bp % 100u);
+    }
+}
+
+#endif // ABENDINFO_EXC_STATS
+
+#if ABENDINFO_UNALIGNED
+static AbendUnalignedSite unalignedSite[ABENDINFO_UNALIGNED];
+static uint32_t unalignedOther;     // emulated at a PC not in the table
+static fn_c_exception_handler_t unalignedFatal;    // cause 9 handler before ours
+
+// The Boot ROM's _xtos_unhandled_exception, the default of the exception table
+static const _xtos_handler kRomUnhandledException = reinterpret_cast<_xtos_handler>(0x4000dc44);
+
+static IRAM_ATTR bool isUnalignedLoadOK(uint32_t addr) {
+    return (0x3ffe8000u <= addr && 0x40010000u > addr) ||  // DRAM and ROM
+           (0x40100000u <= addr && 0x40110000u > addr) ||  // IRAM
+           (0x40200000u <= addr && 0x40300000u > addr);    // flash
+}
+
+static IRAM_ATTR bool isUnalignedStoreOK(uint32_t addr) {
+    return (0x3ffe8000u <= addr && 0x40000000u > addr) ||
+           (0x40100000u <= addr && 0x40110000u > addr);
+}
+
+static IRAM_ATTR uint32_t loadUnaligned(uint32_t addr, uint32_t size) {
+    const uint32_t *p = (const uint32_t *)(addr & ~3u);
+    const uint32_t shift = (addr & 3u) * 8u;
+    uint32_t val = p[0] >> shift;
+    if ((addr & 3u) + size > 4u) {
+        val |= p[1] << (32u - shift);
+    }
+    return (4u == size) ? val : val & 0xffffu;
+}
+
+static IRAM_ATTR void storeUnaligned(uint32_t addr, uint32_t size, uint32_t val) {
+    uint32_t *p = (uint32_t *)(addr & ~3u);
+    const uint32_t shift = (addr & 3u) * 8u;
+    const uint32_t mask = (4u == size) ? ~0u : 0xffffu;
+    val &= mask;
+    p[0] = (p[0] & ~(mask << shift)) | (val << shift);
+    if ((addr & 3u) + size > 4u) {
+        p[1] = (p[1] & ~(mask >> (32u - shift))) | (val >> (32u - shift));
+    }
+}
+
+static IRAM_ATTR void unalignedCount(uint32_t pc, uint32_t addr) {
+    AbendUnalignedSite *free_site = NULL;
+    for (size_t i = 0; i < ABENDINFO_UNALIGNED; i++) {
+        AbendUnalignedSite& e = unalignedSite[i];
+        if (pc == e.pc) {
+            e.count++;
+            e.addr = addr;
+            return;
+        }
+        if (0 == e.pc && NULL == free_site) {
+            free_site = &e;
+        }
+    }
+    if (free_site) {
+        free_site->pc    = pc;
+        free_site->addr  = addr;
+        free_site->count = 1;
+    } else {
+        unalignedOther++;
+    }
+}
+
+static IRAM_ATTR void unalignedHandler(struct __exception_frame *ef, int cause) {
+    uint32_t excvaddr;
+    asm volatile("rsr.excvaddr %0" : "=r"(excvaddr));
+    AbendAccess a;
+    // There is no a1 in the frame, a load or store of a1 is not emulated.
+    if (!abendDecodeAccess(abendFetchInsn(ef->epc), &a) || a.width < 2u ||
+        kAbendAccessLiteral == a.base || 1u == a.reg ||
+        !((a.store) ? isUnalignedStoreOK(excvaddr) : isUnalignedLoadOK(excvaddr))) {
+        excFatal(unalignedFatal, ef, cause);
+        return;
+    }
+    uint32_t *reg = &ef->a0 + ((a.reg) ? a.reg - 1u : 0u);
+    if (a.store) {
+        storeUnaligned(excvaddr, a.width, *reg);
+    } else {
+        uint32_t val = loadUnaligned(excvaddr, a.width);
+        if (a.sign) {
+            val = (uint32_t)(int32_t)(int16_t)val;
+        }
+        *reg = val;
+    }
+    unalignedCount(ef->epc, excvaddr);
+    ef->epc += a.len;
+}
+
+void abendUnalignedInstall(void) {
+    // The ROM C wrapper and the handler abendHandlerInstall() gave cause 20,
+    // the SDK's fatal handler or the exception frame capture in front of it
+    const _xtos_handler c_wrapper = _xtos_exc_handler_table[20];
+    const fn_c_exception_handler_t fatal = _xtos_c_handler_table[20];
+    const _xtos_handler wrapper = _xtos_exc_handler_table[9u /* EXCCAUSE_UNALIGNED */];
+    const fn_c_exception_handler_t previous = _xtos_c_handler_table[9u];
+    if (unalignedHandler == previous) return;
+    if (kRomUnhandledException == wrapper) {
+        unalignedFatal = fatal;
+    } else if (c_wrapper == wrapper && previous) {
+        // The fatal handler, or one the core or Sketch installed, chained to
+        unalignedFatal = previous;
+    } else {
+        return;
+    }
+    _xtos_set_exception_handler(9u, unalignedHandler);
+}
+
+size_t abendUnalignedTop(AbendUnalignedSite *top, size_t n) {
+    AbendUnalignedSite copy[ABENDINFO_UNALIGNED];
+    uint32_t save_ps = xt_rsil(15);
+    memcpy(copy, unalignedSite, sizeof(copy));
+    xt_wsr_ps(save_ps);
+    size_t found = 0;
+    for (; found < n; found++) {
+        AbendUnalignedSite *best = NULL;
+        for (size_t i = 0; i < ABENDINFO_UNALIGNED; i++) {
+            if (copy[i].count && (NULL == best || copy[i].count > best->count)) {
+                best = &copy[i];
+            }
+        }
+        if (NULL == best) break;
+        top[found] = *best;
+        best->count = 0;
+    }
+    return found;
+}
+
+void abendInfoUnalignedReport(Print& sio) {
+    AbendUnalignedSite top[ABENDINFO_UNALIGNED];
+    const size_t n = abendUnalignedTop(top, ABENDINFO_UNALIGNED);
+    sio.printf_P(PSTR("\r\nUnaligned Access Sites:\r\n"));
+    for (size_t i = 0; i < n; i++) {
+        sio.printf_P(PSTR("  PC 0x%08x %10u times, last address 0x%08x\r\n"), top[i].pc, top[i].count, top[i].addr);
+    }
+    if (unalignedOther) {
+        sio.printf_P(PSTR("  %-23S %5u\r\n"), PSTR("sites not tracked:"), unalignedOther);
+    }
+    if (0 == n && 0 == unalignedOther) {
+        sio.printf_P(PSTR("  none\r\n"));
+    }
+}
+#endif // ABENDINFO_UNALIGNED
+
+#endif // ABENDINFO_OPTION && (ABENDINFO_EXC_STATS || ABENDINFO_UNALIGNED || ABENDINFO_FAULT_ACCESS || ABENDINFO_EXC_FRAME)
@@ -49,6 +49,17 @@ extern "C" void ets_install_putc2(fp_putc_t putc);
 // #include <xtensa/corebits.h> not in build path :(
 #include <umm_malloc/umm_malloc.h>
 #include "AbendInfo.h"
+#include "AbendCodec.h"
+#if ABENDINFO_OPTION && ABENDINFO_STACK_WINDOW
+#include "AbendStackWindow.h"
+#endif
+#if ABENDINFO_OPTION && ABENDINFO_ABORT_DETAILS
+#include <exception>
+#include <new>
+#endif
+#if ABENDINFO_OPTION && ABENDINFO_JOURNAL
+#include <spi_flash.h>
+#endif
 
 #ifndef QUOTE
 #define QUOTE(a) __STRINGIFY(a)
@@ -86,9 +97,752 @@ static inline bool is_pc_valid(uint32_t pc) {
 
 #pragma GCC optimize("Os")
 
-AbendInfo abendInfo __attribute__((section(".noinit")));
 AbendInfo resetAbendInfo __attribute__((section(".noinit")));
 
+////////////////////////////////////////////////////////////////////////////////
+// AbendInfo record layouts
+//
+constexpr uint8_t kAbendInfoFlags =
+    ((ABENDINFO_HEAP_MONITOR) ? ABENDINFO_LAYOUT_HEAP_MONITOR : 0u) |
+    ((ABENDINFO_IDENTIFY_SDK_PANIC) ? ABENDINFO_LAYOUT_SDK_PANIC : 0u) |
+    ((ABENDINFO_DEFERRED_GASP) ? ABENDINFO_LAYOUT_DEFERRED_GASP : 0u) |
+    ((ABENDINFO_FAULT_ACCESS) ? ABENDINFO_LAYOUT_FAULT_ACCESS : 0u) |
+    ((ABENDINFO_UNWIND_TABLE) ? ABENDINFO_LAYOUT_BACKTRACE : 0u) |
+    ((ABENDINFO_PANIC_NOTE) ? ABENDINFO_LAYOUT_PANIC_NOTE : 0u) |
+    ((ABENDINFO_ABORT_DETAILS) ? ABENDINFO_LAYOUT_ABORT : 0u);
+
+constexpr uint16_t kAbsent = 0xffffu;
+
+// Field offsets of a record layout, kAbsent for fields not in the layout.
+struct AbendLayout {
+    uint16_t uptime;
+    uint16_t reason;
+    uint16_t exccause;
+    uint16_t oom;
+    uint16_t heap;
+    uint16_t heap_min;
+    uint16_t low_count;
+    uint16_t last;
+    uint16_t epc1;
+    uint16_t intlevel;
+    uint16_t idx;
+    uint16_t gasp;
+    uint16_t gasp_size;
+    uint16_t fmt;
+    uint16_t args;
+    uint16_t excvaddr;
+    uint16_t insn;
+    uint16_t backtrace;
+    uint16_t panic;     // panic_file, panic_func, panic_what, panic_line, then panic_text
+    uint16_t abort;     // abort_kind, abort_pc, abort_sp, alloc_pc, alloc_size
+    uint16_t crc;
+};
+
+/*
+  Field offsets of struct AbendInfo for a given set of layout options. base is
+  the size of the record header, 0 for schema 0 records which had none.
+*/
+constexpr AbendLayout abendLayout(uint32_t base, uint8_t flags, uint32_t gasp_size) {
+    AbendLayout l = {
+        kAbsent, kAbsent, kAbsent, kAbsent, kAbsent, kAbsent, kAbsent,
+        kAbsent, kAbsent, kAbsent, kAbsent, kAbsent, 0, kAbsent, kAbsent,
+        kAbsent, kAbsent, kAbsent, kAbsent, kAbsent, kAbsent
+    };
+    uint32_t ofs = base;
+    l.uptime    = ofs; ofs += sizeof(time_t);
+    l.reason    = ofs; ofs += 4;
+    l.exccause  = ofs; ofs += 4;
+    l.oom       = ofs; ofs += 4;
+    if (flags & ABENDINFO_LAYOUT_HEAP_MONITOR) {
+        l.heap      = ofs; ofs += 4;
+        l.heap_min  = ofs; ofs += 4;
+        l.low_count = ofs; ofs += 4;
+        l.last      = ofs; ofs += 4;
+    }
+    l.epc1      = ofs; ofs += 4;
+    if (flags & ABENDINFO_LAYOUT_SDK_PANIC) {
+        l.intlevel  = ofs; ofs += 4;
+        l.idx       = ofs; ofs += 4;
+        l.gasp      = ofs; ofs += gasp_size;
+        l.gasp_size = gasp_size;
+        ofs = (ofs + 3u) & ~3u;
+    }
+    if (flags & ABENDINFO_LAYOUT_DEFERRED_GASP) {
+        l.fmt       = ofs; ofs += 4;
+        l.args      = ofs; ofs += 4 * ABENDINFO_GASP_ARGS;
+    }
+    if (flags & ABENDINFO_LAYOUT_FAULT_ACCESS) {
+        l.excvaddr  = ofs; ofs += 4;
+        l.insn      = ofs; ofs += 4;
+    }
+    if (flags & ABENDINFO_LAYOUT_BACKTRACE) {
+        l.backtrace = ofs; ofs += 4 * ABENDINFO_BACKTRACE_DEPTH;
+    }
+    if (flags & ABENDINFO_LAYOUT_PANIC_NOTE) {
+        l.panic     = ofs; ofs += 16 + ABENDINFO_PANIC_TEXT;
+    }
+    if (flags & ABENDINFO_LAYOUT_ABORT) {
+        l.abort     = ofs; ofs += 20;
+    }
+    l.crc       = ofs;
+    return l;
+}
+
+// Check abendLayout() against the compiler's layout of this build
+constexpr AbendLayout kAbendLayout = abendLayout(offsetof(AbendInfo, uptime), kAbendInfoFlags, ABENDINFO_GASP_SIZE);
+static_assert(kAbendLayout.uptime   == offsetof(AbendInfo, uptime));
+static_assert(kAbendLayout.reason   == offsetof(AbendInfo, reason));
+static_assert(kAbendLayout.exccause == offsetof(AbendInfo, exccause));
+static_assert(kAbendLayout.oom      == offsetof(AbendInfo, oom));
+static_assert(kAbendLayout.epc1     == offsetof(AbendInfo, epc1));
+static_assert(kAbendLayout.crc      == offsetof(AbendInfo, crc));
+#if ABENDINFO_HEAP_MONITOR
+static_assert(kAbendLayout.heap      == offsetof(AbendInfo, heap));
+static_assert(kAbendLayout.heap_min  == offsetof(AbendInfo, heap_min));
+static_assert(kAbendLayout.low_count == offsetof(AbendInfo, low_count));
+static_assert(kAbendLayout.last      == offsetof(AbendInfo, last));
+#endif
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+static_assert(kAbendLayout.intlevel == offsetof(AbendInfo, intlevel));
+static_assert(kAbendLayout.idx      == offsetof(AbendInfo, idx));
+static_assert(kAbendLayout.gasp     == offsetof(AbendInfo, gasp));
+#endif
+#if ABENDINFO_DEFERRED_GASP
+static_assert(kAbendLayout.fmt      == offsetof(AbendInfo, fmt));
+static_assert(kAbendLayout.args     == offsetof(AbendInfo, args));
+#endif
+#if ABENDINFO_FAULT_ACCESS
+static_assert(kAbendLayout.excvaddr == offsetof(AbendInfo, excvaddr));
+static_assert(kAbendLayout.insn     == offsetof(AbendInfo, insn));
+#endif
+#if ABENDINFO_UNWIND_TABLE
+static_assert(kAbendLayout.backtrace == offsetof(AbendInfo, backtrace));
+#endif
+#if ABENDINFO_PANIC_NOTE
+static_assert(kAbendLayout.panic      == offsetof(AbendInfo, panic_file));
+static_assert(kAbendLayout.panic + 12 == offsetof(AbendInfo, panic_line));
+static_assert(kAbendLayout.panic + 16 == offsetof(AbendInfo, panic_text));
+#endif
+#if ABENDINFO_ABORT_DETAILS
+static_assert(kAbendLayout.abort      == offsetof(AbendInfo, abort_kind));
+static_assert(kAbendLayout.abort + 16 == offsetof(AbendInfo, alloc_size));
+#endif
+
+// Largest record we will try to read. Header, all options, and a 255 byte gasp.
+constexpr size_t kAbendInfoMaxSize = abendLayout(offsetof(AbendInfo, uptime), 0xffu, 255u).crc + 4u;
+
+/*
+  abendInfo is the start of a .noinit area with room for the largest record.
+  A record left by a build with more options is then read by
+  abendInfoMigrate() from memory we own, not from the neighbours of abendInfo.
+*/
+struct AbendInfoArea {
+    AbendInfo info;
+    uint8_t   spare[(kAbendInfoMaxSize > sizeof(AbendInfo)) ? kAbendInfoMaxSize - sizeof(AbendInfo) : 0u];
+};
+static_assert(sizeof(AbendInfoArea) >= kAbendInfoMaxSize);
+extern "C" AbendInfoArea abendInfoArea;
+AbendInfoArea abendInfoArea __attribute__((section(".noinit"), aligned(8)));
+// The asm wrappers and the Sketch use the symbol abendInfo
+extern AbendInfo abendInfo __attribute__((alias("abendInfoArea")));
+
+// Schema 0 records used the default gasp size
+constexpr uint32_t kSchema0GaspSize = 64u;
+// Offsets of schema 0 records, hand coded for the ets_printf wrapper at the time
+static_assert(abendLayout(0, ABENDINFO_LAYOUT_HEAP_MONITOR | ABENDINFO_LAYOUT_SDK_PANIC, kSchema0GaspSize).epc1 == 36);
+static_assert(abendLayout(0, ABENDINFO_LAYOUT_HEAP_MONITOR | ABENDINFO_LAYOUT_SDK_PANIC, kSchema0GaspSize).idx  == 44);
+static_assert(abendLayout(0, ABENDINFO_LAYOUT_SDK_PANIC, kSchema0GaspSize).epc1 == 20);
+static_assert(abendLayout(0, ABENDINFO_LAYOUT_SDK_PANIC, kSchema0GaspSize).idx  == 28);
+
+static inline void abendInfoStamp(AbendInfo& info) {
+    info.magic     = ABENDINFO_MAGIC;
+    info.schema    = ABENDINFO_SCHEMA;
+    info.size      = sizeof(struct AbendInfo);
+    info.flags     = kAbendInfoFlags;
+    info.gasp_size = ABENDINFO_GASP_SIZE;
+}
+
+static inline bool abendInfoIsCurrent(const AbendInfo& info) {
+    return ABENDINFO_MAGIC == info.magic &&
+           ABENDINFO_SCHEMA == info.schema &&
+           sizeof(struct AbendInfo) == info.size &&
+           kAbendInfoFlags == info.flags &&
+           ABENDINFO_GASP_SIZE == info.gasp_size;
+}
+
+static uint32_t getU32(const uint8_t *raw, uint16_t ofs) {
+    uint32_t v = 0;
+    if (kAbsent != ofs) memcpy(&v, &raw[ofs], sizeof(v));
+    return v;
+}
+
+/*
+  Validate the record left in abendInfo by the previous boot. A record
+  written with a different layout, by a build with other options or by an
+  older version of this library, is read field by field and rewritten in the
+  current layout. summed is true for a record from a commit slot, already
+  checked by the slot's sum, its crc field is not set. Older versions of
+  this library left a record with a valid crc in abendInfo. Returns true when
+  abendInfo holds a valid record, its crc is then set.
+*/
+static bool abendInfoMigrate(bool summed) {
+    if (abendInfoIsCurrent(abendInfo)) {
+        if (summed) {
+            abendInfo.crc = crc32(&abendInfo, offsetof(struct AbendInfo, crc));
+            return true;
+        }
+        return abendInfo.crc == crc32(&abendInfo, offsetof(struct AbendInfo, crc));
+    }
+
+    // The old record may be larger than ours. Keep a copy while rewriting.
+    alignas(8) uint8_t raw[kAbendInfoMaxSize];
+    memcpy(raw, &abendInfoArea, sizeof(raw));
+    const AbendInfo *hdr = (const AbendInfo *)raw;
+
+    AbendLayout l;
+    bool ok = false;
+    if (ABENDINFO_MAGIC == hdr->magic && 1u == hdr->schema) {
+        l = abendLayout(offsetof(AbendInfo, uptime), hdr->flags, hdr->gasp_size);
+        ok = l.crc + 4u <= sizeof(raw) &&
+             ((summed) ? l.crc + 4u == hdr->size : getU32(raw, l.crc) == crc32(raw, l.crc));
+    } else if (! summed) {
+        // Schema 0 records have no header. The options used are unknown, try
+        // each and let the CRC decide.
+        for (uint8_t flags = 0; !ok && flags < 4u; flags++) {
+            l = abendLayout(0, flags, (flags & ABENDINFO_LAYOUT_SDK_PANIC) ? kSchema0GaspSize : 0u);
+            ok = (getU32(raw, l.crc) == crc32(raw, l.crc));
+        }
+    }
+    if (! ok) return false;
+
+    memset(&abendInfo, 0, sizeof(struct AbendInfo));
+    abendInfoStamp(abendInfo);
+    int64_t uptime = 0;
+    memcpy(&uptime, &raw[l.uptime], sizeof(uptime));
+    abendInfo.uptime   = (time_t)uptime;
+    abendInfo.reason   = getU32(raw, l.reason);
+    abendInfo.exccause = getU32(raw, l.exccause);
+    abendInfo.oom      = getU32(raw, l.oom);
+    abendInfo.epc1     = getU32(raw, l.epc1);
+#if ABENDINFO_HEAP_MONITOR
+    abendInfo.heap      = getU32(raw, l.heap);
+    abendInfo.heap_min  = getU32(raw, l.heap_min);
+    abendInfo.low_count = getU32(raw, l.low_count);
+    abendInfo.last      = getU32(raw, l.last);
+#endif
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+    abendInfo.intlevel = getU32(raw, l.intlevel);
+    if (kAbsent != l.gasp) {
+        size_t len = strnlen((const char *)&raw[l.gasp], l.gasp_size);
+        if (len >= sizeof(abendInfo.gasp)) len = sizeof(abendInfo.gasp) - 1;
+        memcpy(abendInfo.gasp, &raw[l.gasp], len);
+        abendInfo.idx = len;
+    }
+#endif
+#if ABENDINFO_DEFERRED_GASP
+    abendInfo.fmt = getU32(raw, l.fmt);
+    for (size_t i = 0; i < ABENDINFO_GASP_ARGS; i++) {
+        abendInfo.args[i] = (kAbsent != l.args) ? getU32(raw, l.args + 4u * i) : 0u;
+    }
+#endif
+#if ABENDINFO_FAULT_ACCESS
+    abendInfo.excvaddr = getU32(raw, l.excvaddr);
+    abendInfo.insn     = getU32(raw, l.insn);
+#endif
+#if ABENDINFO_UNWIND_TABLE
+    for (size_t i = 0; i < ABENDINFO_BACKTRACE_DEPTH; i++) {
+        abendInfo.backtrace[i] = (kAbsent != l.backtrace) ? getU32(raw, l.backtrace + 4u * i) : 0u;
+    }
+#endif
+#if ABENDINFO_PANIC_NOTE
+    if (kAbsent != l.panic) {
+        abendInfo.panic_file = getU32(raw, l.panic);
+        abendInfo.panic_func = getU32(raw, l.panic + 4u);
+        abendInfo.panic_what = getU32(raw, l.panic + 8u);
+        abendInfo.panic_line = getU32(raw, l.panic + 12u);
+        memcpy(abendInfo.panic_text, &raw[l.panic + 16u], sizeof(abendInfo.panic_text) - 1u);
+    }
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    if (kAbsent != l.abort) {
+        abendInfo.abort_kind = getU32(raw, l.abort);
+        abendInfo.abort_pc   = getU32(raw, l.abort + 4u);
+        abendInfo.abort_sp   = getU32(raw, l.abort + 8u);
+        abendInfo.alloc_pc   = getU32(raw, l.abort + 12u);
+        abendInfo.alloc_size = getU32(raw, l.abort + 16u);
+    }
+#endif
+    abendInfo.crc = crc32(&abendInfo, offsetof(struct AbendInfo, crc));
+    return true;
+}
+
+/*
+  A/B commit of the crash record. The crash callback copies abendInfo into the
+  slot not holding the latest committed record, then commits it with a single
+  aligned store of the commit word. A second fault or a HWDT part way through
+  leaves the other slot, the last good record, untouched.
+
+  The checksum is a Fletcher style pair of running 32-bit sums, folded in word
+  by word as the record is copied. It is the only check of the record made on
+  the crash path, two adds per word while the record is copied anyway. The
+  record's crc32() is set at the next boot, by abendInfoMigrate().
+
+  Each slot has room for the largest record layout. A slot written by a build
+  with other options is checked over the size in its own record header and
+  converted by abendInfoMigrate() like any other old record.
+*/
+constexpr uint32_t kAbendCommit = 0x434d5441u;    // "ATMC"
+
+struct AbendSlot {
+    uint32_t commit;    // kAbendCommit ^ seq when complete, written last
+    uint32_t seq;       // Increments with each commit, 0 is never used
+    uint32_t sum[2];    // running checksum of seq and the info.size bytes of info
+    union {
+        AbendInfo info;
+        uint8_t   raw[kAbendInfoMaxSize];
+    };
+};
+
+struct AbendCommitArea {
+    AbendSlot slot[2];
+    uint32_t reported;      // seq of the record last handed to resetAbendInfo
+    uint32_t reported_inv;  // ~reported
+};
+static AbendCommitArea abendCommitArea __attribute__((section(".noinit")));
+
+// Rebuilt at each boot by abendCommitLoad()
+static uint32_t abendCommitSeq;     // seq of the latest committed record
+static size_t   abendCommitNext;    // slot for the next commit
+static bool     abendCommitTorn;    // The previous boot's commit did not finish
+
+static_assert(0 == sizeof(AbendInfo) % 4);
+
+struct AbendSum {
+    uint32_t a;
+    uint32_t b;
+
+    inline void add(uint32_t w) {
+        a += w;
+        b += a;
+    }
+};
+
+static inline void memoryBarrier(void) {
+    asm volatile("memw" ::: "memory");
+}
+
+static AbendSum abendSlotSum(const AbendSlot& s) {
+    AbendSum sum = { 0, 0 };
+    sum.add(s.seq);
+    const uint32_t *src = (const uint32_t *)&s.info;
+    for (size_t i = 0; i < s.info.size / 4u; i++) sum.add(src[i]);
+    return sum;
+}
+
+// Any layout, the header only has to describe a record that fits the slot.
+static bool isSlotOK(const AbendSlot& s) {
+    if (0 == s.seq || (kAbendCommit ^ s.seq) != s.commit) return false;
+    if (ABENDINFO_MAGIC != s.info.magic || s.info.size > kAbendInfoMaxSize ||
+        s.info.size < offsetof(AbendInfo, uptime) || (s.info.size & 3u)) {
+        return false;
+    }
+    AbendSum sum = abendSlotSum(s);
+    return sum.a == s.sum[0] && sum.b == s.sum[1];
+}
+
+/*
+  Called from the crash callback. The commit word is cleared before the slot
+  is touched and set after everything else is in memory.
+*/
+static void abendCommitSave(const AbendInfo& info) {
+    AbendSlot& s = abendCommitArea.slot[abendCommitNext];
+    uint32_t seq = abendCommitSeq + 1u;
+    if (0 == seq) seq = 1u;
+    s.commit = 0;
+    s.seq = seq;
+    memoryBarrier();
+    AbendSum sum = { 0, 0 };
+    sum.add(seq);
+    const uint32_t *src = (const uint32_t *)&info;
+    uint32_t *dst = (uint32_t *)&s.info;
+    for (size_t i = 0; i < sizeof(AbendInfo) / 4; i++) {
+        dst[i] = src[i];
+        sum.add(src[i]);
+    }
+    s.sum[0] = sum.a;
+    s.sum[1] = sum.b;
+    memoryBarrier();
+    s.commit = kAbendCommit ^ seq;
+    memoryBarrier();
+}
+
+/*
+  Find the latest committed record. When it has not been reported yet, copy it
+  to abendInfo, in the current layout, and return true. When the previous
+  boot's commit was torn, the last good record is returned again with
+  abendCommitTorn set.
+*/
+static bool abendCommitLoad(void) {
+    AbendCommitArea& area = abendCommitArea;
+    const bool ok[2] = { isSlotOK(area.slot[0]), isSlotOK(area.slot[1]) };
+    size_t latest = 0;
+    if (ok[0] && ok[1]) {
+        // seq wraps, compare by distance
+        latest = ((int32_t)(area.slot[1].seq - area.slot[0].seq) > 0) ? 1 : 0;
+    } else if (ok[1]) {
+        latest = 1;
+    }
+    abendCommitTorn = false;
+    if (! ok[0] && ! ok[1]) {
+        abendCommitSeq  = 0;
+        abendCommitNext = 0;
+        return false;
+    }
+    const AbendSlot& s = area.slot[latest];
+    const AbendSlot& other = area.slot[latest ^ 1u];
+    abendCommitSeq  = s.seq;
+    abendCommitNext = latest ^ 1u;
+
+    bool reported = (area.reported == ~area.reported_inv && area.reported == s.seq);
+    if (reported) {
+        abendCommitTorn = (0 == other.commit && other.seq == s.seq + 1u);
+        if (! abendCommitTorn) return false;
+    }
+    area.reported     = s.seq;
+    area.reported_inv = ~s.seq;
+    memcpy(&abendInfoArea, s.raw, s.info.size);
+    return abendInfoMigrate(true);
+}
+
+#if ABENDINFO_HISTORY_SIZE
+/*
+  Ring of the last ABENDINFO_HISTORY_SIZE crash records. The slot for a record
+  is its sequence number modulo the ring size. The crash record committed by
+  the previous boot is added by abendHandlerInstall(), not on the crash path.
+  Each record carries its own CRC, a torn or stale record only costs that one
+  entry. `seq` is rebuilt from the records at each boot.
+*/
+struct AbendHistory {
+    uint32_t seq;       // seq of the most recent record
+    AbendRecord rec[ABENDINFO_HISTORY_SIZE];
+};
+static AbendHistory abendHistory __attribute__((section(".noinit")));
+
+static inline bool isRecordOK(const AbendRecord& r) {
+    return r.seq && r.crc == crc32(&r, offsetof(struct AbendRecord, crc));
+}
+
+static void abendHistoryAdd(const AbendInfo& info) {
+    uint32_t seq = ++abendHistory.seq;
+    if (0 == seq) seq = abendHistory.seq = 1;   // 0 is reserved for empty
+    AbendRecord& r = abendHistory.rec[seq % ABENDINFO_HISTORY_SIZE];
+    r.seq      = seq;
+    r.uptime   = (uint32_t)info.uptime;
+    r.reason   = info.reason;
+    r.exccause = info.exccause;
+    r.epc1     = info.epc1;
+    r.oom      = info.oom;
+    r.crc = crc32(&r, offsetof(struct AbendRecord, crc));
+}
+
+/*
+  Validate the history ring left from previous boot cycles. Clear records
+  failing the CRC check and recover the most recent sequence number.
+*/
+static void abendHistoryInit(void) {
+    uint32_t seq = 0;
+    for (size_t i = 0; i < ABENDINFO_HISTORY_SIZE; i++) {
+        AbendRecord& r = abendHistory.rec[i];
+        if (isRecordOK(r) && (r.seq % ABENDINFO_HISTORY_SIZE) == i) {
+            if (r.seq > seq) seq = r.seq;
+        } else {
+            memset(&r, 0, sizeof(struct AbendRecord));
+        }
+    }
+    abendHistory.seq = seq;
+}
+
+const AbendRecord *abendHistoryRecord(size_t age) {
+    if (age >= ABENDINFO_HISTORY_SIZE || age >= abendHistory.seq) return NULL;
+    uint32_t seq = abendHistory.seq - age;
+    const AbendRecord& r = abendHistory.rec[seq % ABENDINFO_HISTORY_SIZE];
+    return (r.seq == seq && isRecordOK(r)) ? &r : NULL;
+}
+#endif
+
+#if ABENDINFO_FINGERPRINT_SIZE
+/*
+  Hashed table of crash fingerprints. Repeats of a crash share a slot, the
+  count and last uptime are updated. Open addressing with linear probing,
+  slots are never emptied. When the table is full, the slot with the lowest
+  count is reused.
+*/
+struct AbendFingerprints {
+    AbendFingerprint slot[ABENDINFO_FINGERPRINT_SIZE];
+    uint32_t crc;       // Must be last element
+};
+static AbendFingerprints abendFingerprints __attribute__((section(".noinit")));
+
+static inline uint32_t fnv1a(uint32_t hash, uint8_t c) {
+    return (hash ^ c) * 16777619u;
+}
+
+static uint32_t fnv1a(uint32_t hash, uint32_t u32) {
+    for (size_t i = 0; i < 4; i++, u32 >>= 8) {
+        hash = fnv1a(hash, (uint8_t)u32);
+    }
+    return hash;
+}
+
+static uint32_t abendFingerprint(const AbendInfo& info) {
+    uint32_t hash = 2166136261u;
+    hash = fnv1a(hash, info.reason);
+    hash = fnv1a(hash, info.exccause);
+    hash = fnv1a(hash, info.epc1);
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+    // Normalize gasp text: drop leading and trailing white space and collapse
+    // runs of white space to a single space.
+    bool space = false;
+    bool text  = false;
+    for (size_t i = 0; i < sizeof(info.gasp) && info.gasp[i]; i++) {
+        char c = info.gasp[i];
+        if (' ' == c || '\t' == c) {
+            space = text;
+            continue;
+        }
+        if (space) hash = fnv1a(hash, (uint8_t)' ');
+        hash = fnv1a(hash, (uint8_t)c);
+        space = false;
+        text  = true;
+    }
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    hash = fnv1a(hash, info.abort_kind);
+#endif
+#if ABENDINFO_PANIC_NOTE
+    // Build independent, "file:line" of a panic() or assert()
+    for (size_t i = 0; i < sizeof(info.panic_text) && info.panic_text[i]; i++) {
+        hash = fnv1a(hash, (uint8_t)info.panic_text[i]);
+    }
+#endif
+    return (hash) ? hash : 1u;  // 0 marks an empty slot
+}
+
+static void abendFingerprintAdd(const AbendInfo& info) {
+    const uint32_t fp = abendFingerprint(info);
+    AbendFingerprint *e = NULL;
+    size_t victim = fp % ABENDINFO_FINGERPRINT_SIZE;
+    for (size_t i = 0, idx = victim; i < ABENDINFO_FINGERPRINT_SIZE; i++) {
+        AbendFingerprint& s = abendFingerprints.slot[idx];
+        if (fp == s.fingerprint || 0 == s.fingerprint) {
+            e = &s;
+            break;
+        }
+        if (s.count < abendFingerprints.slot[victim].count) victim = idx;
+        if (++idx >= ABENDINFO_FINGERPRINT_SIZE) idx = 0;
+    }
+    if (NULL == e) {
+        e = &abendFingerprints.slot[victim];
+        e->fingerprint = 0;
+    }
+    if (fp != e->fingerprint) {
+        e->fingerprint = fp;
+        e->count    = 0;
+        e->first    = (uint32_t)info.uptime;
+        e->reason   = info.reason;
+        e->exccause = info.exccause;
+        e->epc1     = info.epc1;
+        e->gasp[0]  = '\0';
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+        strncpy(e->gasp, info.gasp, sizeof(e->gasp) - 1);
+        e->gasp[sizeof(e->gasp) - 1] = '\0';
+#endif
+    }
+    e->count++;
+    e->last = (uint32_t)info.uptime;
+    abendFingerprints.crc = crc32(&abendFingerprints, offsetof(struct AbendFingerprints, crc));
+}
+
+static void abendFingerprintInit(void) {
+    if (abendFingerprints.crc != crc32(&abendFingerprints, offsetof(struct AbendFingerprints, crc))) {
+        memset(&abendFingerprints, 0, sizeof(abendFingerprints));
+        abendFingerprints.crc = crc32(&abendFingerprints, offsetof(struct AbendFingerprints, crc));
+    }
+}
+
+size_t abendFingerprintTop(AbendFingerprint *top, size_t n) {
+    bool taken[ABENDINFO_FINGERPRINT_SIZE] = {};
+    size_t copied = 0;
+    for (; copied < n; copied++) {
+        size_t best = ABENDINFO_FINGERPRINT_SIZE;
+        for (size_t i = 0; i < ABENDINFO_FINGERPRINT_SIZE; i++) {
+            const AbendFingerprint& s = abendFingerprints.slot[i];
+            if (taken[i] || 0 == s.fingerprint) continue;
+            if (ABENDINFO_FINGERPRINT_SIZE == best || s.count > abendFingerprints.slot[best].count) best = i;
+        }
+        if (ABENDINFO_FINGERPRINT_SIZE == best) break;
+        taken[best] = true;
+        top[copied] = abendFingerprints.slot[best];
+    }
+    return copied;
+}
+#endif
+
+#if ABENDINFO_JOURNAL
+static bool journalFlashRead(uint32_t addr, void *buf, size_t len) {
+    return SPI_FLASH_RESULT_OK == spi_flash_read(addr, (uint32_t *)buf, len);
+}
+
+static bool journalFlashWrite(uint32_t addr, const void *buf, size_t len) {
+    return SPI_FLASH_RESULT_OK == spi_flash_write(addr, (uint32_t *)buf, len);
+}
+
+static bool journalFlashErase(uint32_t addr) {
+    return SPI_FLASH_RESULT_OK == spi_flash_erase_sector(addr / SPI_FLASH_SEC_SIZE);
+}
+
+static AbendJournal abendJournal = {
+    { journalFlashRead, journalFlashWrite, journalFlashErase },
+    ABENDINFO_JOURNAL_ADDR, ABENDINFO_JOURNAL_SECTORS, SPI_FLASH_SEC_SIZE,
+    0, 0, 0, 0, false
+};
+
+static bool abendJournalReady(void) {
+    return abendJournal.mounted || abendJournalMount(&abendJournal);
+}
+
+/*
+  Called from abendHandlerInstall() with the crash record carried over from
+  the previous boot. Never called from the crash path.
+*/
+static void abendJournalCommit(const AbendInfo& info) {
+    if (! abendJournalReady()) return;
+    AbendJournalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.uptime   = (uint32_t)info.uptime;
+    rec.reason   = info.reason;
+    rec.exccause = info.exccause;
+    rec.epc1     = info.epc1;
+    rec.oom      = info.oom;
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+    strncpy(rec.gasp, info.gasp, sizeof(rec.gasp) - 1);
+#endif
+    abendJournalAppend(&abendJournal, &rec);
+}
+
+bool abendJournalGet(size_t age, AbendJournalRecord *rec) {
+    return abendJournalReady() && abendJournalRead(&abendJournal, age, rec);
+}
+#endif
+
+static void abendCodecRecord(const AbendInfo& info, AbendCodecRecord *rec) {
+    memset(rec, 0, sizeof(AbendCodecRecord));
+    rec->uptime   = (uint32_t)info.uptime;
+    rec->reason   = info.reason;
+    rec->exccause = info.exccause;
+    rec->epc1     = info.epc1;
+    rec->oom      = info.oom;
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+    strncpy(rec->gasp, info.gasp, sizeof(rec->gasp) - 1);
+#endif
+}
+
+#if ABENDINFO_RTC_MEMORY
+/*
+  Reset counters and a log of compact crash records, see AbendCodec.h, kept in
+  RTC user memory. Unlike .noinit DRAM, RTC memory holds through deep sleep and
+  external reset. It is read, updated, and written back once per boot by
+  abendHandlerInstall(), nothing is written from the crash path. The crash
+  record reaches RTC memory at the boot following the crash, by way of
+  .noinit. When the log is full, the oldest records are dropped.
+*/
+constexpr uint32_t kAbendRtcMagic = 0x52424e41u;    // "ANBR"
+constexpr uint32_t kAbendRtcBlock = 64u + ABENDINFO_RTC_OFFSET / 4u;  // User memory starts at block 64
+constexpr size_t   kAbendRtcResets = REASON_EXT_SYS_RST + 1u;
+
+struct AbendRtc {
+    uint32_t magic;
+    uint16_t reset[kAbendRtcResets];    // Boots by rst_info reason, saturates
+    uint16_t used;      // Bytes of log in use
+    uint32_t seq;       // seq of the most recent crash record
+    uint8_t  log[ABENDINFO_RTC_SIZE - 28u];    // Encoded records, oldest first
+    uint32_t crc;       // Must be last element
+};
+static_assert(ABENDINFO_RTC_SIZE == sizeof(AbendRtc));
+
+static bool abendRtcRead(AbendRtc& rtc) {
+    return system_rtc_mem_read(kAbendRtcBlock, &rtc, sizeof(AbendRtc)) &&
+           kAbendRtcMagic == rtc.magic &&
+           rtc.used <= sizeof(rtc.log) &&
+           rtc.crc == crc32(&rtc, offsetof(struct AbendRtc, crc));
+}
+
+/*
+  Called from abendHandlerInstall() with the reset reason and the crash
+  record carried over from the previous boot, if any.
+*/
+static void abendRtcUpdate(uint32_t reason, const AbendInfo *info) {
+    AbendRtc rtc;
+    if (! abendRtcRead(rtc)) {
+        memset(&rtc, 0, sizeof(rtc));
+        rtc.magic = kAbendRtcMagic;
+    }
+    if (reason < kAbendRtcResets && rtc.reset[reason] < 0xffffu) {
+        rtc.reset[reason]++;
+    }
+    if (info) {
+        uint8_t buf[kAbendCodecMaxSize];
+        AbendCodecRecord rec;
+        abendCodecRecord(*info, &rec);
+        rec.seq = ++rtc.seq;
+        size_t len = abendCodecEncode(&rec, buf, sizeof(buf));
+        if (len && len <= sizeof(rtc.log)) {
+            // Drop the oldest records until there is room
+            size_t drop = 0;
+            while (rtc.used - drop + len > sizeof(rtc.log)) {
+                size_t n = abendCodecDecode(&rtc.log[drop], rtc.used - drop, &rec);
+                drop = (n) ? drop + n : rtc.used;
+            }
+            memmove(rtc.log, &rtc.log[drop], rtc.used - drop);
+            rtc.used -= drop;
+            memcpy(&rtc.log[rtc.used], buf, len);
+            rtc.used += len;
+        }
+    }
+    rtc.crc = crc32(&rtc, offsetof(struct AbendRtc, crc));
+    system_rtc_mem_write(kAbendRtcBlock, &rtc, sizeof(AbendRtc));
+}
+
+uint32_t abendRtcResetCount(uint32_t reason) {
+    AbendRtc rtc;
+    if (reason >= kAbendRtcResets || ! abendRtcRead(rtc)) return 0;
+    return rtc.reset[reason];
+}
+
+/*
+  Records are self delimiting and stored oldest first. Walk the log to count
+  them, then again to the one wanted.
+*/
+static bool abendRtcRecord(const AbendRtc& rtc, size_t age, AbendCodecRecord *rec) {
+    size_t count = 0;
+    for (size_t pos = 0, n; pos < rtc.used; pos += n, count++) {
+        n = abendCodecDecode(&rtc.log[pos], rtc.used - pos, rec);
+        if (0 == n) return false;
+    }
+    if (age >= count) return false;
+    size_t pos = 0;
+    for (size_t i = count - 1u - age; i; i--) {
+        pos += abendCodecDecode(&rtc.log[pos], rtc.used - pos, rec);
+    }
+    return 0 != abendCodecDecode(&rtc.log[pos], rtc.used - pos, rec);
+}
+
+bool abendRtcRecord(size_t age, AbendCodecRecord *rec) {
+    AbendRtc rtc;
+    return abendRtcRead(rtc) && abendRtcRecord(rtc, age, rec);
+}
+#endif
+
 extern "C" {
 extern struct rst_info resetInfo;
 
@@ -105,22 +859,208 @@ enum rst_reason_sw {
 
 #if ABENDINFO_IDENTIFY_SDK_PANIC
 
-#if ABENDINFO_HEAP_MONITOR
-#define ABENDINFO_EPC1     36
-#define ABENDINFO_INTLEVEL 40
-#define ABENDINFO_IDX      44
+#if ABENDINFO_GASP_RING
+/*
+  The last lines of ets_printf output, in .noinit. Characters go to a byte
+  ring, each line records where it starts and the CPU cycle count at its
+  first character. Positions are free running, line boundaries survive the
+  text wrapping around. The crash callback seals the ring so the Postmortem
+  and our own report do not push out the lines before the crash. At boot,
+  abendHandlerInstall() copies a ring left by the previous boot to
+  resetGaspRing and starts a new one.
+*/
+constexpr uint32_t kAbendGaspMagic = 0x50534147u;     // "GASP"
+
+struct AbendGaspLine {
+    uint32_t ccount;    // at the first character
+    uint32_t start;     // position of the first character
+};
+
+struct AbendGaspRing {
+    uint32_t magic;
+    uint32_t cpu_mhz;
+    uint32_t sealed;    // cycle count at the crash callback | 1, 0 while open
+    uint32_t head;      // characters written
+    uint32_t lines;     // lines started
+    uint32_t open;      // a line is in progress
+    AbendGaspLine line[ABENDINFO_GASP_LINES];
+    char     buf[ABENDINFO_GASP_RING];
+};
+static AbendGaspRing abendGaspRing __attribute__((section(".noinit")));
+static AbendGaspRing resetGaspRing __attribute__((section(".noinit")));
+
+/*
+  A few stores with interrupts off, the same for every character. An ISR's
+  ets_printf can not split the update of a line.
+*/
+static IRAM_ATTR void abendGaspRingPutc(char c) {
+    AbendGaspRing& r = abendGaspRing;
+    if (r.sealed || '\r' == c) return;
+    uint32_t save_ps = xt_rsil(15);
+    if ('\n' == c) {
+        r.open = 0;
+    } else {
+        if (0 == r.open) {
+            AbendGaspLine& l = r.line[r.lines % ABENDINFO_GASP_LINES];
+            l.ccount = esp_get_cycle_count();
+            l.start  = r.head;
+            r.lines++;
+            r.open = 1;
+        }
+        r.buf[r.head % ABENDINFO_GASP_RING] = c;
+        r.head++;
+    }
+    xt_wsr_ps(save_ps);
+}
+
+static bool isGaspRingOK(const AbendGaspRing& r) {
+    return kAbendGaspMagic == r.magic && r.lines <= r.head &&
+           (0 == r.lines || r.line[(r.lines - 1u) % ABENDINFO_GASP_LINES].start < r.head);
+}
+
+static void abendGaspRingInit(uint32_t reason) {
+    AbendGaspRing& r = abendGaspRing;
+    if (isNoinitHeld(reason) && isGaspRingOK(r)) {
+        resetGaspRing = r;
+    } else {
+        resetGaspRing.magic = 0;
+    }
+    uint32_t save_ps = xt_rsil(15);
+    memset(&r, 0, offsetof(struct AbendGaspRing, buf));
+    r.magic   = kAbendGaspMagic;
+    r.cpu_mhz = ets_get_cpu_frequency();
+    xt_wsr_ps(save_ps);
+}
+#endif // ABENDINFO_GASP_RING
+
+#if ABENDINFO_LOG_RING
+/*
+  All ets_printf output, kept for abendLogDrain(). Single consumer, loop();
+  producers are ets_printf callers at any interrupt level. A line is written
+  past head and only published, by storing head, at its end. The consumer
+  never sees part of a line and never takes a lock.
+
+  A line dropped by the rate limiter or for lack of space is discarded by not
+  publishing it. The rate limiter keys on a hash of the first word of the
+  line, eg. "pm", "scandone", or "wifi", and allows ABENDINFO_LOG_RATE lines
+  a second for each.
+*/
+constexpr uint32_t kAbendLogMagic = 0x474f4c41u;      // "ALOG"
+constexpr uint32_t kAbendLogPrefixMax = 12u;          // Longest first word hashed
+
+enum AbendLogState : uint32_t { kLogIdle = 0, kLogPrefix, kLogBody, kLogDrop };
+
+struct AbendLogSource {
+    uint32_t window;    // cycle count at the start of the current second
+    uint32_t count;     // lines in the current second
+};
+
+struct AbendLogRing {
+    uint32_t magic;
+    volatile uint32_t head;     // end of published lines, written by producers
+    volatile uint32_t tail;     // written by abendLogDrain()
+    uint32_t wpos;              // end of the line in progress
+    uint32_t line;              // start of the line in progress
+    uint32_t hash;
+    uint32_t state;             // AbendLogState
+    uint32_t second;            // CPU cycles in a second
+    uint32_t lost;              // lines dropped, ring full
+    uint32_t limited;           // lines dropped by the rate limiter
+    uint32_t lost_shown;        // Counts already noted by abendLogDrain()
+    uint32_t limited_shown;
+    AbendLogSource source[ABENDINFO_LOG_SOURCES];
+    char     buf[ABENDINFO_LOG_RING];
+};
+#if ABENDINFO_LOG_NOINIT
+static AbendLogRing abendLogRing __attribute__((section(".noinit")));
 #else
-#define ABENDINFO_EPC1     20
-#define ABENDINFO_INTLEVEL 24
-#define ABENDINFO_IDX      28
+static AbendLogRing abendLogRing;
 #endif
 
-static_assert(offsetof(AbendInfo, intlevel) == ABENDINFO_INTLEVEL);
-static_assert(offsetof(AbendInfo, epc1) == ABENDINFO_EPC1);
-static_assert(offsetof(AbendInfo, idx) == ABENDINFO_IDX);
+static IRAM_ATTR bool isLogLimited(AbendLogRing& r) {
+    AbendLogSource& s = r.source[(r.hash ^ (r.hash >> 8)) % ABENDINFO_LOG_SOURCES];
+    const uint32_t now = esp_get_cycle_count();
+    if (now - s.window >= r.second) {
+        s.window = now;
+        s.count  = 0;
+    }
+    if (s.count >= ABENDINFO_LOG_RATE) return true;
+    s.count++;
+    return false;
+}
 
+static IRAM_ATTR void abendLogPutc(char c) {
+    AbendLogRing& r = abendLogRing;
+    if ('\r' == c || kAbendLogMagic != r.magic) return;
+    uint32_t save_ps = xt_rsil(15);
+    if (kLogIdle == r.state) {
+        r.line  = r.wpos = r.head;
+        r.hash  = 5381u;
+        r.state = kLogPrefix;
+    }
+    if (kLogDrop != r.state) {
+        if (r.wpos - r.tail >= ABENDINFO_LOG_RING) {
+            r.lost++;
+            r.state = kLogDrop;
+        } else {
+            r.buf[r.wpos % ABENDINFO_LOG_RING] = c;
+            r.wpos++;
+        }
+    }
+    if (kLogPrefix == r.state) {
+        if (' ' == c || ':' == c || '\n' == c || r.wpos - r.line >= kAbendLogPrefixMax) {
+            if (isLogLimited(r)) {
+                r.limited++;
+                r.state = kLogDrop;
+            } else {
+                r.state = kLogBody;
+            }
+        } else {
+            r.hash = r.hash * 33u + (uint8_t)c;
+        }
+    }
+    if ('\n' == c) {
+        if (kLogDrop != r.state) {
+            memoryBarrier();
+            r.head = r.wpos;
+        }
+        r.state = kLogIdle;
+    }
+    xt_wsr_ps(save_ps);
+}
+
+static void abendLogInit([[maybe_unused]] uint32_t reason) {
+    AbendLogRing& r = abendLogRing;
+    uint32_t save_ps = xt_rsil(15);
+    bool keep = false;
+#if ABENDINFO_LOG_NOINIT
+    // Lines not drained before the restart, when DRAM held through it
+    keep = isNoinitHeld(reason) && kAbendLogMagic == r.magic && r.head - r.tail <= ABENDINFO_LOG_RING;
+#endif
+    if (keep) {
+        r.state = kLogIdle;
+        r.lost_shown = r.lost;
+        r.limited_shown = r.limited;
+    } else {
+        memset(&r, 0, offsetof(struct AbendLogRing, buf));
+        r.magic = kAbendLogMagic;
+    }
+    r.second = ets_get_cpu_frequency() * 1000000u;
+    xt_wsr_ps(save_ps);
+}
+
+#endif // ABENDINFO_LOG_RING
 
 static IRAM_ATTR void _gasp_putc(char c) {
+#if ABENDINFO_PRINTF_HISTOGRAM
+    abendPrintfStats.chars++;
+#endif
+#if ABENDINFO_LOG_RING
+    abendLogPutc(c);
+#endif
+#if ABENDINFO_GASP_RING
+    abendGaspRingPutc(c);
+#endif
     if (sizeof(abendInfo.gasp) - 2 <= abendInfo.idx) return;
     if ('\r' != c && '\n' != c) {
         abendInfo.gasp[abendInfo.idx++] = c;
@@ -143,12 +1083,38 @@ static IRAM_ATTR void _gasp_putc(char c) {
     #define panic() \
       ets_printf("%s %u\n", moduleId, __LINE__); \
       while (true) { }
+
+  Offsets into abendInfo are asm operands generated from struct AbendInfo,
+  they follow the layout for any combination of options. Operands require
+  extended asm in a function body. This function is never called, it only
+  carries the ets_printf replacement into its own IRAM section.
 */
-asm(
-    ".section     .iram.text.infinite_ets_printf,\"ax\",@progbits\n\t"
+static_assert(offsetof(AbendInfo, epc1) <= 1020 && 0 == offsetof(AbendInfo, epc1) % 4);
+static_assert(offsetof(AbendInfo, intlevel) <= 1020 && 0 == offsetof(AbendInfo, intlevel) % 4);
+static_assert(offsetof(AbendInfo, idx) <= 1020 && 0 == offsetof(AbendInfo, idx) % 4);
+#if ABENDINFO_DEFERRED_GASP
+static_assert(offsetof(AbendInfo, args) + 16 <= 1020 && 0 == offsetof(AbendInfo, fmt) % 4);
+static_assert(5 == ABENDINFO_GASP_ARGS, "the ets_printf wrapper stores a3 ... a7");
+#endif
+#if ABENDINFO_PRINTF_HISTOGRAM
+static_assert(0 == offsetof(AbendPrintfStats, chars));
+#endif
+#if ABENDINFO_SDK_PANIC_INDEX
+static_assert(0 == offsetof(AbendSdkPanicIndex, bitmap) && offsetof(AbendSdkPanicIndex, count) <= 1020);
+#endif
+
+static void __attribute__((used)) ets_printf_wrapper_asm(void) {
+asm volatile(
+    ".pushsection .iram.text.infinite_ets_printf,\"ax\",@progbits\n\t"
     ".literal_position\n\t"
     ".literal     .abendInfo, abendInfo\n\t"
     ".literal     .rom_ets_printf, 0x400024cc\n\t"  // Boot ROM ets_printf
+#if ABENDINFO_SDK_PANIC_INDEX
+    ".literal     .abendSdkPanicIndex, abendSdkPanicIndex\n\t"
+#endif
+#if ABENDINFO_PRINTF_HISTOGRAM
+    ".literal     .abendPrintfStats, abendPrintfStats\n\t"
+#endif
     ".align       4\n\t"
     ".global      ets_printf\n\t"
     ".type        ets_printf, @function\n\t"
@@ -159,18 +1125,66 @@ asm(
     "s32i         a12,    a1,     4\n\t"
     "addi         a12,    a1,     16\n\t"
     "s32i         a12,    a1,     8\n\t"    // Finish Stack Frame for Postmotem
+#if ABENDINFO_PRINTF_HISTOGRAM
+    // Characters so far and the format, for abendPrintfCount()
+    "l32r         a0,     .abendPrintfStats\n\t"
+    "s32i         a2,     a0,     %c[pfmt]\n\t"
+    "l32i         a0,     a0,     0\n\t"
+    "s32i         a0,     a1,     0\n\t"
+#endif
 
     // While no previous infinite loop detected, clear last gasp index.
     "l32r         a0,     .abendInfo\n\t"
-    "l32i         a12,    a0,     " QUOTE( ABENDINFO_EPC1 ) "\n\t"
+    "l32i         a12,    a0,     %c[epc1]\n\t"
     "bnez         a12,    ets_printf_continue\n\t"  // Capture 1st event
 
-    "s32i         a12,    a0,     " QUOTE( ABENDINFO_IDX ) "\n\t"  // abendInfo.idx
+    "s32i         a12,    a0,     %c[idx]\n\t"  // abendInfo.idx
+#if ABENDINFO_DEFERRED_GASP
+    // Format and register arguments, formatted after restart
+    "s32i         a2,     a0,     %c[fmt]\n\t"
+    "s32i         a3,     a0,     %c[args]\n\t"
+    "s32i         a4,     a0,     %c[args] + 4\n\t"
+    "s32i         a5,     a0,     %c[args] + 8\n\t"
+    "s32i         a6,     a0,     %c[args] + 12\n\t"
+    "s32i         a7,     a0,     %c[args] + 16\n\t"
+#endif
     "\n"
 "ets_printf_continue:\n\t"
     "l32r         a0,     .rom_ets_printf\n\t"
     "callx0       a0\n\t"
+#if ABENDINFO_PRINTF_HISTOGRAM
+    "l32i         a3,     a1,     0\n\t"
+    "s32i         a2,     a1,     0\n\t"    // ets_printf's return value
+    "l32i         a2,     a1,     12\n\t"
+    "call0        abendPrintfCount\n\t"
+    "l32i         a2,     a1,     0\n\t"
+#endif
     "bnez         a12,    ets_printf_exit\n\t"  // Capture 1st event
+#if ABENDINFO_SDK_PANIC_INDEX
+    /*
+      Sites found at boot, see AbendSdkPanic.cpp. Most calls stop at the
+      bitmap test. Until the index is built, inspect the code.
+    */
+    "l32r         a3,     .abendSdkPanicIndex\n\t"
+    "l32i         a4,     a3,     %c[count]\n\t"
+    "l32i         a0,     a1,     12\n\t"
+    "beqz         a4,     ets_printf_inspect\n\t"
+    "extui        a4,     a0,     3,     8\n\t"
+    "add          a4,     a4,     a3\n\t"
+    "l8ui         a4,     a4,     0\n\t"
+    "extui        a5,     a0,     0,     3\n\t"
+    "bbc          a4,     a5,     ets_printf_exit\n\t"
+    "s32i         a2,     a1,     0\n\t"    // ets_printf's return value
+    "mov          a2,     a0\n\t"
+    "call0        abendSdkPanicSiteFind\n\t"
+    "mov          a3,     a2\n\t"
+    "l32i         a2,     a1,     0\n\t"
+    "l32i         a0,     a1,     12\n\t"
+    "beqz         a3,     ets_printf_exit\n\t"
+    "j            ets_printf_panic\n\t"
+    "\n"
+"ets_printf_inspect:\n\t"
+#endif
     /*
       After ets_printf has done its part. We check if we are returning to an
       infinite loop. If so, the return address location will contain 0xffff06.
@@ -192,11 +1206,13 @@ asm(
     // Return is to an Infinite Loop. Save location for later processing at
     // custom_crash_callback. To ensure a stack trace, force crash with
     // Exception 0.
+    "\n"
+"ets_printf_panic:\n\t"
     "l32r         a5,     .abendInfo\n\t"
     "rsr.ps       a12\n\t"
     "extui        a12,    a12,    0,     4\n\t"
-    "s32i         a0,     a5,     " QUOTE( ABENDINFO_EPC1 ) "\n\t"
-    "s32i         a12,    a5,     " QUOTE( ABENDINFO_INTLEVEL ) "\n\t"
+    "s32i         a0,     a5,     %c[epc1]\n\t"
+    "s32i         a12,    a5,     %c[intlevel]\n\t"
     "movi         a2,     0\n\t"
     "call0        ets_install_putc2\n\t"
 "ets_printf_sdk_panic:\n\t" // Add self explaining label for addr2line to display
@@ -208,14 +1224,235 @@ asm(
     "l32i         a1,     a1,     8\n\t"
     "ret\n\t"
     ".size ets_printf, .-ets_printf\n\t"
+    ".popsection\n\t"
+    ::  [epc1]"n"(offsetof(struct AbendInfo, epc1)),
+        [intlevel]"n"(offsetof(struct AbendInfo, intlevel)),
+        [idx]"n"(offsetof(struct AbendInfo, idx))
+#if ABENDINFO_SDK_PANIC_INDEX
+        , [count]"n"(offsetof(struct AbendSdkPanicIndex, count))
+#endif
+#if ABENDINFO_PRINTF_HISTOGRAM
+        , [pfmt]"n"(offsetof(struct AbendPrintfStats, fmt))
+#endif
+#if ABENDINFO_DEFERRED_GASP
+        , [fmt]"n"(offsetof(struct AbendInfo, fmt))
+        , [args]"n"(offsetof(struct AbendInfo, args))
+#endif
 );
+}
 #endif // ABENDINFO_IDENTIFY_SDK_PANIC
 
 
+#if ABENDINFO_STACK_WINDOW
+/*
+  The words of the crash stack from the stack pointer up, run-length encoded
+  by the crash callback, see AbendStackWindow.h. One pass over at most
+  ABENDINFO_STACK_WINDOW words. Offline, tools/abendstack.cpp decodes the
+  report and looks up the code addresses in the ELF. At boot, a window left
+  by the previous boot is taken for the report and marked as seen, it is not
+  reported again after another restart.
+*/
+constexpr uint32_t kAbendStackMagic = 0x4b545357u;    // "WSTK"
+
+struct AbendStackWindowArea {
+    uint32_t magic;
+    uint32_t sp;        // stack pointer given to the crash callback
+    uint32_t stack_end;
+    uint16_t words;     // stack words encoded
+    uint16_t stored;    // words of code used
+    uint32_t filtered;  // only code addresses kept
+    uint32_t code[ABENDINFO_STACK_WINDOW_AREA];
+};
+static_assert(ABENDINFO_STACK_WINDOW <= kAbendStackRleMaxCount && ABENDINFO_STACK_WINDOW_AREA <= 0xffffu);
+static AbendStackWindowArea abendStackWindow __attribute__((section(".noinit")));
+static bool stackWindowHeld;
+
+static void abendStackWindowInit(uint32_t reason) {
+    AbendStackWindowArea& w = abendStackWindow;
+    stackWindowHeld = isNoinitHeld(reason) && kAbendStackMagic == w.magic &&
+                      w.words <= ABENDINFO_STACK_WINDOW && w.stored <= ABENDINFO_STACK_WINDOW_AREA;
+    w.magic = 0;
+}
+
+static void abendStackWindowSave(uint32_t stack, uint32_t stack_end) {
+    AbendStackWindowArea& w = abendStackWindow;
+    w.magic = 0;
+    if (0 == stack || stack_end <= stack || (stack & 3u)) return;
+    size_t n = (stack_end - stack) / 4u;
+    if (n > ABENDINFO_STACK_WINDOW) n = ABENDINFO_STACK_WINDOW;
+    size_t used = 0;
+    w.sp        = stack;
+    w.stack_end = stack_end;
+    w.filtered  = ABENDINFO_STACK_WINDOW_FILTER;
+    w.stored    = abendStackRleEncode((const uint32_t *)stack, n,
+                      (ABENDINFO_STACK_WINDOW_FILTER) ? is_pc_valid : NULL,
+                      w.code, ABENDINFO_STACK_WINDOW_AREA, &used);
+    w.words     = used;
+    w.magic     = kAbendStackMagic;
+}
+#endif // ABENDINFO_STACK_WINDOW
+
+#if ABENDINFO_PANIC_NOTE
+extern "C" void __assert_func(const char *file, int line, const char *func, const char *failedexpr) __attribute__((noreturn));
+
+// Return address of the abendPanic() or abendAssert() call
+static uint32_t panicCaller;
+
+/*
+  Runs before the crash, it is not time critical. The strings can be in flash
+  and are copied with the _P functions.
+*/
+static void abendPanicNote(const char *file, int line, const char *func, const char *what, uint32_t caller) {
+    abendInfo.panic_file = (uint32_t)file;
+    abendInfo.panic_func = (uint32_t)func;
+    abendInfo.panic_what = (uint32_t)what;
+    abendInfo.panic_line = (uint32_t)line;
+    panicCaller = caller;
+    const char *base = file;
+    if (file) {
+        for (const char *p = file; pgm_read_byte(p); p++) {
+            const char c = pgm_read_byte(p);
+            if ('/' == c || '\\' == c) base = p + 1;
+        }
+    }
+    snprintf_P(abendInfo.panic_text, sizeof(abendInfo.panic_text), PSTR("%S:%d %S"),
+        (base) ? base : PSTR("?"), line, (func) ? func : PSTR(""));
+}
+
+extern "C" void abendPanic(const char *file, int line, const char *func) {
+    abendPanicNote(file, line, func, NULL, (uint32_t)__builtin_return_address(0));
+    __panic_func(file, line, func);
+}
+
+extern "C" void abendAssert(const char *file, int line, const char *func, const char *what) {
+    abendPanicNote(file, line, func, what, (uint32_t)__builtin_return_address(0));
+    __assert_func(file, line, func, what);
+}
+
+#endif // ABENDINFO_PANIC_NOTE
+
+#if ABENDINFO_ABORT_DETAILS
+extern "C" void __stack_chk_fail(void);
+#if defined(__cpp_exceptions)
+extern "C" void __cxa_throw(void *, void *, void (*)(void *));
+#endif
+// Set by the core's malloc wrappers at each failed allocation
+extern "C" void *umm_last_fail_alloc_addr;
+extern "C" int umm_last_fail_alloc_size;
+
+// Stack words looked at for the return address of a call that did not return
+constexpr size_t kAbortScanWords = 64u;
+
+static std::terminate_handler terminatePrevious;
+static bool terminateCalled;
+static bool terminateBadAlloc;
+
+static void abendTerminate(void) {
+    terminateCalled = true;
+#if defined(__cpp_exceptions)
+    if (std::current_exception()) {
+        try {
+            throw;
+        } catch (const std::bad_alloc&) {
+            terminateBadAlloc = true;
+        } catch (...) {
+        }
+    }
+#endif
+    if (terminatePrevious) terminatePrevious();
+    abort();
+}
+
+/*
+  Returns the target of the call ending at return address ra, or 0. Both
+  call0 and the "l32r aN, target; callx0 aN" pair of -mlongcalls are decoded.
+  A callx0 with other instructions placed between it and its l32r is not.
+*/
+static uint32_t callTarget(uint32_t ra) {
+    if (! is_pc_valid(ra) || ! is_pc_valid(ra - 3u)) return 0;
+    const uint32_t pc = ra - 3u;
+    const uint8_t *code = (const uint8_t *)pc;
+    const uint32_t insn = pgm_read_byte(&code[0]) | (pgm_read_byte(&code[1]) << 8) | (pgm_read_byte(&code[2]) << 16);
+    if (5u == (insn & 0x3fu)) {                             // call0
+        const int32_t offset = (int32_t)(insn << 8) >> 14;  // 18 bits, in words
+        return (pc & ~3u) + ((uint32_t)offset << 2) + 4u;
+    }
+    if (0x0000c0u != (insn & 0xfff0ffu) || ! is_pc_valid(pc - 3u)) return 0;  // callx0
+    const uint32_t reg = (insn >> 8) & 0xfu;
+    const uint8_t *lit = code - 3;
+    const uint32_t l32r = pgm_read_byte(&lit[0]) | (pgm_read_byte(&lit[1]) << 8) | (pgm_read_byte(&lit[2]) << 16);
+    if (1u != (l32r & 0xfu) || reg != ((l32r >> 4) & 0xfu)) return 0;  // l32r to the same register
+    // From the l32r address plus 3, rounded down. The 16 bit word offset is
+    // extended with ones, the literal is below.
+    const uint32_t addr = (pc & ~3u) + ((0xffff0000u | (l32r >> 8)) << 2);
+    if (! is_pc_valid(addr)) return 0;
+    return pgm_read_dword((const uint32_t *)addr);
+}
+
+/*
+  Returns the return address of a call to target found on the stack from sp
+  up, or 0. Only calls that never returned, eg. to __stack_chk_fail, are
+  looked for, a stale return address can not match.
+*/
+static uint32_t findCallTo(uint32_t sp, uint32_t stack_end, uint32_t target) {
+    const uint32_t *p = (const uint32_t *)sp;
+    for (size_t i = 0; i < kAbortScanWords && sp + 4u * i + 4u <= stack_end; i++) {
+        if (target == callTarget(p[i])) return p[i];
+    }
+    return 0;
+}
+
+// True when the return address ra is on the stack from sp up
+static bool isOnStack(uint32_t sp, uint32_t stack_end, uint32_t ra) {
+    const uint32_t *p = (const uint32_t *)sp;
+    for (size_t i = 0; i < kAbortScanWords && sp + 4u * i + 4u <= stack_end; i++) {
+        if (ra == p[i]) return true;
+    }
+    return false;
+}
+
+/*
+  Sorts out a user software exception or stack smash for the crash record.
+  Returns the caller found, 0 for none. It becomes epc1, each site is a
+  separate crash.
+*/
+static uint32_t abendAbortNote(struct rst_info *rst_info, uint32_t stack, uint32_t stack_end) {
+    AbendInfo& r = abendInfo;
+    r.abort_kind = ABEND_ABORT_NONE;
+    r.abort_pc   = 0;
+    r.abort_sp   = 0;
+    r.alloc_pc   = (uint32_t)umm_last_fail_alloc_addr;
+    r.alloc_size = (r.alloc_pc) ? (uint32_t)umm_last_fail_alloc_size : 0u;
+    if (REASON_USER_STACK_SMASH == rst_info->reason) {
+        r.abort_kind = ABEND_ABORT_STACK_SMASH;
+        r.abort_pc   = findCallTo(stack, stack_end, (uint32_t)__stack_chk_fail);
+    } else if (REASON_USER_SWEXCEPTION_RST == rst_info->reason) {
+        if (terminateCalled && ! terminateBadAlloc) {
+            r.abort_kind = ABEND_ABORT_TERMINATE;
+#if defined(__cpp_exceptions)
+            r.abort_pc   = findCallTo(stack, stack_end, (uint32_t)__cxa_throw);
+#endif
+        } else if (terminateBadAlloc ||
+                   (r.alloc_pc && isOnStack(stack, stack_end, r.alloc_pc))) {
+            // Without C++ exceptions, a failed operator new aborts. It saved
+            // its return address, alloc_pc, on the stack. The core never
+            // clears alloc_pc, a failure handled earlier is not on the stack.
+            r.abort_kind = ABEND_ABORT_OUT_OF_MEMORY;
+            r.abort_pc   = r.alloc_pc;
+        }
+    }
+    if (ABEND_ABORT_NONE == r.abort_kind) return 0;
+    r.abort_sp = stack;
+    return r.abort_pc;
+}
+#endif // ABENDINFO_ABORT_DETAILS
+
 static void abendUpdateHeapStats(void) {
     abendInfo.oom = umm_get_oom_count();
+#if ABENDINFO_HEAP_MONITOR
     abendInfo.heap = umm_free_heap_size_lw(); // ESP.getFreeHeap();
     abendInfo.heap_min = umm_free_heap_size_min();
+#endif
 }
 
 
@@ -236,7 +1473,40 @@ extern void SHARE_CUSTOM_CRASH_CB__DEBUG_ESP_ABENDINFO(
 {
     (void)stack;
     (void)stack_end;
+    [[maybe_unused]] const uint32_t fault_pc = rst_info->epc1;
+#if ABENDINFO_GASP_RING
+    // Before anything else is printed
+    abendGaspRing.sealed = esp_get_cycle_count() | 1u;
+#endif
+#if ABENDINFO_UNALIGNED || ABENDINFO_EXC_FRAME
+    if (REASON_EXCEPTION_RST == rst_info->reason) {
+        // The Postmortem's fixed offset does not include the frame of our
+        // exception handler in front of the SDK's fatal handler.
+        stack = abendExcStack(stack);
+    }
+#endif
+#if ABENDINFO_EXC_FRAME
+    abendExcFrameSeal(stack, stack_end);
+#endif
     abendInfo.uptime = (time_t)(micros64() / 1000000);
+    // The caller of a panic or abort, the crash record's epc1 when it has none
+    [[maybe_unused]] uint32_t caller = 0;
+#if ABENDINFO_PANIC_NOTE
+    if (REASON_USER_SWEXCEPTION_RST != rst_info->reason) {
+        // Only a panic() or assert() that ended here
+        abendInfo.panic_file = abendInfo.panic_func = abendInfo.panic_what = 0;
+        abendInfo.panic_line = 0;
+        abendInfo.panic_text[0] = '\0';
+    } else if (abendInfo.panic_line) {
+        // Point at the caller, each panic() or assert() is a separate crash.
+        // rst_info is left as is for the crash callbacks that follow.
+        caller = panicCaller;
+    }
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    const uint32_t abort_caller = abendAbortNote(rst_info, stack, stack_end);
+    if (0 == caller) caller = abort_caller;
+#endif
     SHOW_PRINTF("\nAbendInfo:\n");
     if (rst_info->reason == REASON_EXCEPTION_RST) {
         if (20u /* EXCCAUSE_INSTR_PROHIBITED */ == rst_info->exccause &&
@@ -283,17 +1553,58 @@ extern void SHARE_CUSTOM_CRASH_CB__DEBUG_ESP_ABENDINFO(
     if (0 == abendInfo.epc1 || 0 == abendInfo.idx) {
        abendInfo.gasp[0] = '\0';
     }
+#endif
+#if ABENDINFO_DEFERRED_GASP
+    if (0 == abendInfo.epc1) {
+        // Only the ets_printf of an SDK panic is kept
+        abendInfo.fmt = 0;
+    }
 #endif
     // Archive net adjustments from Postmortem and above
     abendUpdateHeapStats(); // final update
     if (abendInfo.oom) {
         SHOW_PRINTF("  Heap OOM count: %u\r\n", abendInfo.oom);
     }
-    abendInfo.epc1     = rst_info->epc1;
+    abendInfo.epc1     = (rst_info->epc1) ? rst_info->epc1 : caller;
     abendInfo.reason   = rst_info->reason;
     abendInfo.exccause = rst_info->exccause;
+#if ABENDINFO_FAULT_ACCESS
+    abendInfo.excvaddr = rst_info->excvaddr;
+    abendInfo.insn     = 0;
+    if (REASON_EXCEPTION_RST == rst_info->reason && is_pc_valid(rst_info->epc1)) {
+        switch (rst_info->exccause) {
+            case 3:     // LoadStoreError
+            case 9:     // LoadStoreAlignment
+            case 28:    // LoadProhibited
+            case 29:    // StoreProhibited
+                abendInfo.insn = abendFetchInsn(rst_info->epc1) & 0x00ffffffu;
+                break;
+        }
+    }
+#endif
+#if ABENDINFO_UNWIND_TABLE
+    memset(abendInfo.backtrace, 0, sizeof(abendInfo.backtrace));
+    if (REASON_EXCEPTION_RST == rst_info->reason || REASON_SOFT_WDT_RST == rst_info->reason) {
+        // The exception vector saved a0 in excsave1. For a call to an invalid
+        // address, Exception 20, it is the return address of the call.
+        uint32_t a0;
+        __asm__ __volatile__("rsr.excsave1 %[a0]\n\t" : [a0]"=r"(a0):: "memory");
+        abendUnwind((is_pc_valid(fault_pc)) ? fault_pc : 0u, a0, stack, stack_end,
+            abendInfo.backtrace, ABENDINFO_BACKTRACE_DEPTH);
+    }
+#endif
+#if ABENDINFO_STACK_WINDOW
+    abendStackWindowSave(stack, stack_end);
+#endif
     SHOW_PRINTF("\n");
-    abendInfo.crc = crc32(&abendInfo, offsetof(struct AbendInfo, crc));
+    abendInfoStamp(abendInfo);
+    // The slot's running sum is the record's only check on the crash path.
+    // History and fingerprints are added from it at the next boot.
+    abendCommitSave(abendInfo);
+#if ABENDINFO_COREDUMP
+    // Last, the record above is already committed if this runs out of time.
+    abendCoreDumpWrite(rst_info, stack, stack_end);
+#endif
 }
 
 extern void _DebugExceptionVector(void);
@@ -367,6 +1678,117 @@ static void install_unhandled_exception_handler(void) {
 #endif  // ABENDINFO_REPLACE_ALL_DEFAULT_EXC_HANDLERS
 
 
+#if ABENDINFO_RESET_STATS
+/*
+  Restart counters and uptime statistics, kept in .noinit next to abendInfo.
+  Updated once per boot by abendHandlerInstall(), a handful of adds and the
+  running checksum from the A/B commit, no crc32().
+
+  Uptime of the boot that just ended comes from the crash record when there
+  is one, else from the last abendUptimeMark(). Uptime accumulated since the
+  previous failure becomes a sample when a failure is counted. Restarts that
+  are not failures, eg. ESP.restart() or deep sleep, only add uptime.
+*/
+struct AbendResetStats {
+    uint32_t count[ABEND_RESET_CAUSES];
+    uint32_t boots;
+    uint32_t uptime;    // seconds, total of all previous boots
+    uint32_t since;     // seconds of uptime since the most recent failure
+    uint32_t samples;   // count of samples ever added to between[]
+    uint32_t between[ABENDINFO_RESET_STATS];  // seconds of uptime between failures
+    uint32_t sum[2];    // Must be last element
+};
+static AbendResetStats abendResetStats __attribute__((section(".noinit")));
+
+// Written during the boot, each value is paired with its inverse.
+struct AbendResetMark {
+    uint32_t uptime;    // seconds
+    uint32_t uptime_inv;
+    uint32_t cause;     // AbendResetCause requested by the Sketch
+    uint32_t cause_inv;
+};
+static AbendResetMark abendResetMark __attribute__((section(".noinit")));
+
+static AbendSum abendResetStatsSum(void) {
+    AbendSum sum = { 0, 0 };
+    const uint32_t *p = (const uint32_t *)&abendResetStats;
+    for (size_t i = 0; i < offsetof(struct AbendResetStats, sum) / 4; i++) sum.add(p[i]);
+    return sum;
+}
+
+static int abendResetCauseOf(uint32_t reason, const AbendInfo *info) {
+    int cause = -1;
+    if (info) reason = info->reason;    // may be one of ours, eg. REASON_SDK_PANIC
+    switch (reason) {
+        case REASON_EXCEPTION_RST:        cause = ABEND_RESET_EXCEPTION; break;
+        case REASON_SDK_PANIC:            cause = ABEND_RESET_SDK_PANIC; break;
+        case REASON_SOFT_WDT_RST:         cause = ABEND_RESET_SOFT_WDT; break;
+        case REASON_WDT_RST:              cause = ABEND_RESET_HARDWARE_WDT; break;
+        case REASON_USER_STACK_SMASH:     cause = ABEND_RESET_STACK_SMASH; break;
+        case REASON_USER_SWEXCEPTION_RST: cause = ABEND_RESET_USER_PANIC; break;
+        default: break;
+    }
+#if ABENDINFO_ABORT_DETAILS
+    if (ABEND_RESET_USER_PANIC == cause && info && ABEND_ABORT_OUT_OF_MEMORY == info->abort_kind) {
+        cause = ABEND_RESET_OUT_OF_MEMORY;
+    }
+#endif
+    if (ABEND_RESET_USER_PANIC == cause || REASON_SOFT_RESTART == reason) {
+        const AbendResetMark& m = abendResetMark;
+        if (m.cause == ~m.cause_inv && m.cause < ABEND_RESET_CAUSES) cause = m.cause;
+    }
+    return cause;
+}
+
+static void abendResetStatsUpdate(uint32_t reason, const AbendInfo *info) {
+    AbendResetStats& s = abendResetStats;
+    AbendSum sum = abendResetStatsSum();
+    if (sum.a != s.sum[0] || sum.b != s.sum[1]) {
+        memset(&s, 0, sizeof(s));
+    }
+    uint32_t uptime = 0;
+    if (info) {
+        uptime = (uint32_t)info->uptime;
+    } else if (abendResetMark.uptime == ~abendResetMark.uptime_inv) {
+        uptime = abendResetMark.uptime;
+    }
+    s.boots++;
+    s.uptime += uptime;
+    s.since  += uptime;
+    int cause = abendResetCauseOf(reason, info);
+    if (cause >= 0) {
+        s.count[cause]++;
+        s.between[s.samples % ABENDINFO_RESET_STATS] = s.since;
+        s.samples++;
+        s.since = 0;
+    }
+    sum = abendResetStatsSum();
+    s.sum[0] = sum.a;
+    s.sum[1] = sum.b;
+
+    abendResetMark.uptime     = 0;
+    abendResetMark.uptime_inv = ~0u;
+    abendResetMark.cause      = ABEND_RESET_CAUSES;
+    abendResetMark.cause_inv  = ~(uint32_t)ABEND_RESET_CAUSES;
+}
+
+uint32_t abendResetCount(AbendResetCause cause) {
+    return (cause < ABEND_RESET_CAUSES) ? abendResetStats.count[cause] : 0;
+}
+
+void abendSetRestartCause(AbendResetCause cause) {
+    abendResetMark.cause     = cause;
+    abendResetMark.cause_inv = ~(uint32_t)cause;
+}
+
+void abendUptimeMark(void) {
+    uint32_t uptime = (uint32_t)(micros64() / 1000000);
+    abendResetMark.uptime_inv = ~0u;    // invalid while updating
+    abendResetMark.uptime     = uptime;
+    abendResetMark.uptime_inv = ~uptime;
+}
+#endif
+
 // call from setup() or preinit()
 /*
   update - Patch Arduino's copy of rst_info
@@ -374,6 +1796,27 @@ static void install_unhandled_exception_handler(void) {
 extern "C" void abendHandlerInstall(bool update) {
     const size_t new_debug_vector_sz  = ALIGN_UP((uintptr_t)&new_debug_vector_last - (uintptr_t)new_debug_vector, 4);
 
+#if ABENDINFO_GASP_RING
+    // Before putc2 is installed
+    abendGaspRingInit(ESP.getResetInfoPtr()->reason);
+#endif
+#if ABENDINFO_LOG_RING
+    abendLogInit(ESP.getResetInfoPtr()->reason);
+#endif
+#if ABENDINFO_EXC_FRAME
+    abendExcFrameInit(ESP.getResetInfoPtr()->reason);
+#endif
+#if ABENDINFO_STACK_WINDOW
+    abendStackWindowInit(ESP.getResetInfoPtr()->reason);
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    {
+        // Chains to the handler it replaces, not to itself when installed again
+        const std::terminate_handler previous = std::set_terminate(abendTerminate);
+        if (abendTerminate != previous) terminatePrevious = previous;
+    }
+#endif
+
     if (! gdb_present()) {
         uint32_t save_ps = xt_rsil(15);
         // Check if putc handler is in IRAM
@@ -393,6 +1836,16 @@ extern "C" void abendHandlerInstall(bool update) {
         #else
         _xtos_set_exception_handler(20u /* EXCCAUSE_INSTR_PROHIBITED */, _xtos_c_handler_table[0]);
         #endif
+        #if ABENDINFO_EXC_FRAME
+        // First, unaligned accesses not emulated go to the frame capture.
+        abendExcFrameInstall();
+        #endif
+        #if ABENDINFO_UNALIGNED
+        abendUnalignedInstall();
+        #endif
+        #if ABENDINFO_EXC_STATS
+        abendExcStatsInstall();
+        #endif
         ets_memcpy((void*)_DebugExceptionVector, (void*)new_debug_vector, new_debug_vector_sz);
         // No need to zero exccause, epc1 and excsave1 - the timer tick for the
         // Soft WDT is constantly setting these. Set the rest to zero.
@@ -411,7 +1864,9 @@ extern "C" void abendHandlerInstall(bool update) {
     // Update resetAbendInfo with data from previous boot crash cycle
     // init abendInfo for the new boot cycle
     const uint32_t reason = ESP.getResetInfoPtr()->reason;
-    bool abendOK = (abendInfo.crc == crc32(&abendInfo, offsetof(struct AbendInfo, crc)));
+    // A record left by an older version of this library is still in abendInfo
+    bool abendOK = abendCommitLoad() || abendInfoMigrate(false);
+    [[maybe_unused]] bool carried = abendOK;
     if (abendOK && (REASON_SOFT_RESTART == reason || 100u < abendInfo.reason)) {
         // Added Software Exceptions eg. panic()
         // Don't expect to have valid data after these:
@@ -426,16 +1881,52 @@ extern "C" void abendHandlerInstall(bool update) {
          REASON_WDT_RST       == reason) ) {
 
         resetAbendInfo = abendInfo;
-        if (resetAbendInfo.epc1 && update) {
+        // A torn commit returns the record of an earlier boot, not this reset
+        if (resetAbendInfo.epc1 && update && ! abendCommitTorn) {
             // Patch Arduino's copy of rst_info
             resetInfo.epc1     = resetAbendInfo.epc1;
             resetInfo.reason   = resetAbendInfo.reason;
             resetInfo.exccause = resetAbendInfo.exccause;
         }
     } else {
+        carried = false;
         memset(&resetAbendInfo, 0, sizeof(struct AbendInfo));
     }
+    if (abendCommitTorn) {
+        // Only shown again. It was journaled, mirrored to RTC memory, and
+        // counted at an earlier boot.
+        carried = false;
+    }
     memset(&abendInfo, 0, sizeof(struct AbendInfo));
+    abendInfoStamp(abendInfo);
+    #if ABENDINFO_JOURNAL
+    // Only a crash record carried over from the previous boot is journaled.
+    if (carried) {
+        abendJournalCommit(resetAbendInfo);
+    }
+    #endif
+    #if ABENDINFO_RTC_MEMORY
+    abendRtcUpdate(reason, (carried) ? &resetAbendInfo : NULL);
+    #endif
+    #if ABENDINFO_RESET_STATS
+    abendResetStatsUpdate(reason, (carried) ? &resetAbendInfo : NULL);
+    #endif
+    #if ABENDINFO_HISTORY_SIZE
+    abendHistoryInit();
+    if (carried) {
+        abendHistoryAdd(resetAbendInfo);
+    }
+    #endif
+    #if ABENDINFO_FINGERPRINT_SIZE
+    abendFingerprintInit();
+    if (carried) {
+        abendFingerprintAdd(resetAbendInfo);
+    }
+    #endif
+    #if ABENDINFO_SDK_PANIC_INDEX
+    // With interrupts enabled, the wrapper inspects code until it is built.
+    abendSdkPanicIndexBuild();
+    #endif
     #if ABENDINFO_HEAP_MONITOR
     abendInfo.last = millis();
     #endif
@@ -457,6 +1948,113 @@ void abendInfoHeapReport(Print& sio, const char *qualifier, AbendInfo& info) {
     }
 #endif
 }
+
+size_t abendInfoEncode(const AbendInfo& info, uint8_t *buf, size_t len) {
+    AbendCodecRecord rec;
+    abendCodecRecord(info, &rec);
+    return abendCodecEncode(&rec, buf, len);
+}
+
+#if ABENDINFO_HISTORY_SIZE || ABENDINFO_JOURNAL || ABENDINFO_FINGERPRINT_SIZE || ABENDINFO_RTC_MEMORY
+static PGM_P reasonLabel(uint32_t reason) {
+    switch (reason) {
+        case REASON_DEFAULT_RST:          return PSTR("Power On");
+        case REASON_WDT_RST:              return PSTR("Hardware WDT");
+        case REASON_EXCEPTION_RST:        return PSTR("Exception");
+        case REASON_SOFT_WDT_RST:         return PSTR("Software WDT");
+        case REASON_SOFT_RESTART:         return PSTR("Restart");
+        case REASON_DEEP_SLEEP_AWAKE:     return PSTR("Deep-Sleep Wake");
+        case REASON_EXT_SYS_RST:          return PSTR("External System");
+        case REASON_SDK_PANIC:            return PSTR("SDK Panic");
+        case REASON_USER_STACK_SMASH:     return PSTR("Stack smashed");
+        case REASON_USER_SWEXCEPTION_RST: return PSTR("User SW Exception");
+        default:                          return PSTR("Unknown");
+    }
+}
+#endif
+
+#if ABENDINFO_HISTORY_SIZE
+void abendInfoHistoryReport(Print& sio) {
+    const AbendRecord *r = abendHistoryRecord(0);
+    if (NULL == r) return;
+    sio.printf_P(PSTR("\r\nCrash History: (most recent first)\r\n"));
+    for (size_t age = 0; r; r = abendHistoryRecord(++age)) {
+        sio.printf_P(PSTR("  #%-5u %-18S EXCCAUSE %2u @0x%08x  uptime %u sec"),
+            r->seq, reasonLabel(r->reason), r->exccause, r->epc1, r->uptime);
+        if (r->oom) {
+            sio.printf_P(PSTR(", OOM %u"), r->oom);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+}
+#endif
+
+#if ABENDINFO_FINGERPRINT_SIZE
+void abendInfoFingerprintReport(Print& sio, size_t top) {
+    AbendFingerprint list[ABENDINFO_FINGERPRINT_SIZE];
+    const size_t count = abendFingerprintTop(list, (top < ABENDINFO_FINGERPRINT_SIZE) ? top : ABENDINFO_FINGERPRINT_SIZE);
+    if (0 == count) return;
+    sio.printf_P(PSTR("\r\nCrash Fingerprints: (most frequent first)\r\n"));
+    for (size_t i = 0; i < count; i++) {
+        const AbendFingerprint& f = list[i];
+        sio.printf_P(PSTR("  %5ux %08x %-18S EXCCAUSE %2u @0x%08x  uptime %u - %u sec"),
+            f.count, f.fingerprint, reasonLabel(f.reason), f.exccause, f.epc1, f.first, f.last);
+        if (f.gasp[0]) {
+            sio.printf_P(PSTR(", '%s'"), f.gasp);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+}
+#endif
+
+#if ABENDINFO_JOURNAL
+void abendInfoJournalReport(Print& sio, size_t count) {
+    if (! abendJournalReady()) return;
+    const uint32_t total = abendJournalCount(&abendJournal);
+    sio.printf_P(PSTR("\r\nFlash Crash Journal: %u records\r\n"), total);
+    for (size_t age = 0; age < count && age < total; age++) {
+        AbendJournalRecord rec;
+        if (! abendJournalRead(&abendJournal, age, &rec)) {
+            sio.printf_P(PSTR("  #%-5u (damaged)\r\n"), abendJournal.latest_seq - age);
+            continue;
+        }
+        sio.printf_P(PSTR("  #%-5u %-18S EXCCAUSE %2u @0x%08x  uptime %u sec"),
+            rec.seq, reasonLabel(rec.reason), rec.exccause, rec.epc1, rec.uptime);
+        if (rec.gasp[0]) {
+            sio.printf_P(PSTR(", '%s'"), rec.gasp);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+}
+#endif
+
+#if ABENDINFO_RTC_MEMORY
+void abendInfoRtcReport(Print& sio) {
+    AbendRtc rtc;
+    if (! abendRtcRead(rtc)) return;
+    sio.printf_P(PSTR("\r\nRTC Memory Reset Counts:\r\n"));
+    for (size_t i = 0; i < kAbendRtcResets; i++) {
+        if (rtc.reset[i]) {
+            sio.printf_P(PSTR("  %-23S %5u\r\n"), reasonLabel(i), rtc.reset[i]);
+        }
+    }
+    AbendCodecRecord rec;
+    if (! abendRtcRecord(rtc, 0, &rec)) return;
+    sio.printf_P(PSTR("RTC Memory Crash Log: (most recent first)\r\n"));
+    for (size_t age = 1; ; age++) {
+        sio.printf_P(PSTR("  #%-5u %-18S EXCCAUSE %2u @0x%08x  uptime %u sec"),
+            rec.seq, reasonLabel(rec.reason), rec.exccause, rec.epc1, rec.uptime);
+        if (rec.oom) {
+            sio.printf_P(PSTR(", OOM %u"), rec.oom);
+        }
+        if (rec.gasp[0]) {
+            sio.printf_P(PSTR(", '%s'"), rec.gasp);
+        }
+        sio.printf_P(PSTR("\r\n"));
+        if (! abendRtcRecord(rtc, age, &rec)) break;
+    }
+}
+#endif
 #endif //#if ABENDINFO_OPTION
 
 static void printTime(Print& sio, PGM_P label, time_t time) {
@@ -471,8 +2069,150 @@ static void printTime(Print& sio, PGM_P label, time_t time) {
     }
 
 }
+#if ABENDINFO_RESET_STATS
+static void printDuration(Print& sio, PGM_P label, uint32_t secs) {
+    sio.printf_P(PSTR("  %-23S %ud %02u:%02u:%02u\r\n"), label,
+        secs / 86400u, secs / 3600u % 24u, secs / 60u % 60u, secs % 60u);
+}
+
+void abendInfoResetStatsReport(Print& sio) {
+    static const char label_exception[]  PROGMEM = "Exception:";
+    static const char label_sdk_panic[]  PROGMEM = "SDK Panic:";
+    static const char label_soft_wdt[]   PROGMEM = "Software WDT:";
+    static const char label_hwdt[]       PROGMEM = "Hardware WDT:";
+    static const char label_user_panic[] PROGMEM = "User Panic:";
+    static const char label_network[]    PROGMEM = "Network Health:";
+    static const char label_heap_low[]   PROGMEM = "Heap Low:";
+    static const char label_smash[]      PROGMEM = "Stack Smash:";
+    static const char label_oom[]        PROGMEM = "Out of Memory:";
+    static const char * const labels[ABEND_RESET_CAUSES] PROGMEM = {
+        label_exception, label_sdk_panic, label_soft_wdt, label_hwdt,
+        label_user_panic, label_network, label_heap_low, label_smash,
+        label_oom
+    };
+    const AbendResetStats& s = abendResetStats;
+    uint32_t failures = 0;
+    sio.printf_P(PSTR("\r\nRestart Statistics: (%u boots)\r\n"), s.boots);
+    for (size_t i = 0; i < ABEND_RESET_CAUSES; i++) {
+        failures += s.count[i];
+        if (s.count[i]) {
+            sio.printf_P(PSTR("  %-23S %5u\r\n"), (PGM_P)pgm_read_ptr(&labels[i]), s.count[i]);
+        }
+    }
+    const uint32_t uptime = s.uptime + (uint32_t)(micros64() / 1000000);
+    printDuration(sio, PSTR("Total uptime:"), uptime);
+    if (0 == failures) return;
+    printDuration(sio, PSTR("MTBF:"), uptime / failures);
+
+    // Uptime between failures, the most recent samples sorted
+    uint32_t sorted[ABENDINFO_RESET_STATS];
+    const size_t n = (s.samples < ABENDINFO_RESET_STATS) ? s.samples : ABENDINFO_RESET_STATS;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = s.between[i];
+        size_t j = i;
+        for (; j && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+    sio.printf_P(PSTR("  Uptime between failures, last %u:\r\n"), n);
+    printDuration(sio, PSTR("  min:"), sorted[0]);
+    printDuration(sio, PSTR("  median:"), sorted[(n - 1) / 2]);
+    printDuration(sio, PSTR("  90th percentile:"), sorted[(n * 9 - 1) / 10]);
+    printDuration(sio, PSTR("  max:"), sorted[n - 1]);
+}
+#endif
+
+#if ABENDINFO_LOG_RING
+size_t abendLogAvailable(void) {
+    return abendLogRing.head - abendLogRing.tail;
+}
+
+size_t abendLogDrain(Print& out, size_t max) {
+    AbendLogRing& r = abendLogRing;
+    if (kAbendLogMagic != r.magic) return 0;
+    size_t written = 0;
+    const uint32_t lost    = r.lost;
+    const uint32_t limited = r.limited;
+    if (lost != r.lost_shown || limited != r.limited_shown) {
+        written += out.printf_P(PSTR("[log: %u lines lost to a full ring, %u rate limited]\n"),
+            lost - r.lost_shown, limited - r.limited_shown);
+        r.lost_shown    = lost;
+        r.limited_shown = limited;
+    }
+    uint32_t tail = r.tail;
+    const uint32_t head = r.head;
+    memoryBarrier();
+    size_t n = head - tail;
+    if (n > max) n = max;
+    while (n) {
+        size_t len = ABENDINFO_LOG_RING - tail % ABENDINFO_LOG_RING;
+        if (len > n) len = n;
+        len = out.write((const uint8_t *)&r.buf[tail % ABENDINFO_LOG_RING], len);
+        if (0 == len) break;
+        tail    += len;
+        written += len;
+        n       -= len;
+        memoryBarrier();
+        r.tail = tail;
+    }
+    return written;
+}
+#endif
+
+#if ABENDINFO_GASP_RING
+void abendInfoGaspRingReport(Print& sio) {
+    const AbendGaspRing& r = resetGaspRing;
+    if (kAbendGaspMagic != r.magic || 0 == r.lines) return;
+    const uint32_t n = (r.lines < ABENDINFO_GASP_LINES) ? r.lines : ABENDINFO_GASP_LINES;
+    // Times are before the crash callback, or before the last line when the
+    // boot ended without one, eg. Hardware WDT. Cycle counts wrap after
+    // 2^32 cycles, 53 seconds at 80 MHz.
+    const uint32_t ref = (r.sealed) ? r.sealed : r.line[(r.lines - 1u) % ABENDINFO_GASP_LINES].ccount;
+    const uint32_t mhz = (r.cpu_mhz) ? r.cpu_mhz : 80u;
+    sio.printf_P(PSTR("\r\nLast %u lines of ets_printf output before %S:\r\n"),
+        n, (r.sealed) ? PSTR("the crash") : PSTR("the restart"));
+    for (uint32_t i = r.lines - n; i != r.lines; i++) {
+        const AbendGaspLine& l = r.line[i % ABENDINFO_GASP_LINES];
+        const uint32_t end = (i + 1u != r.lines) ? r.line[(i + 1u) % ABENDINFO_GASP_LINES].start : r.head;
+        uint32_t start = l.start;
+        if (r.head - start > ABENDINFO_GASP_RING) start = r.head - ABENDINFO_GASP_RING;
+        if ((int32_t)(end - start) <= 0) continue;  // overwritten
+        const uint32_t us = (ref - l.ccount) / mhz;
+        sio.printf_P(PSTR("  -%6u.%03u ms  %S"), us / 1000u, us % 1000u, (start != l.start) ? PSTR("...") : PSTR(""));
+        for (uint32_t j = start; j != end; j++) {
+            char c = r.buf[j % ABENDINFO_GASP_RING];
+            sio.write((' ' <= c && '~' >= c) ? c : '.');
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+}
+#endif
+
+#if ABENDINFO_STACK_WINDOW
+void abendInfoStackWindowReport(Print& sio) {
+    const AbendStackWindowArea& w = abendStackWindow;
+    if (! stackWindowHeld) return;
+    // tools/abendstack.cpp reads these lines from a log
+    sio.printf_P(PSTR("\r\nStack window, %u words%S:\r\n"),
+        w.words, (w.filtered) ? PSTR(", code addresses only") : PSTR(""));
+    sio.printf_P(PSTR("  stk sp 0x%08x end 0x%08x words %u filter %u\r\n"),
+        w.sp, w.stack_end, w.words, w.filtered);
+    for (size_t i = 0; i < w.stored; i += 8u) {
+        sio.printf_P(PSTR("  stk"));
+        for (size_t j = i; j < i + 8u && j < w.stored; j++) {
+            sio.printf_P(PSTR(" %08x"), w.code[j]);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    }
+}
+#endif
+
 void abendInfoReport(Print& sio, bool heap) {
     sio.printf_P(PSTR("\nRestart Report:\n  "));
+#if ABENDINFO_OPTION > 0
+    if (abendCommitTorn) {
+        sio.printf_P(PSTR("Crash record incomplete, previous record shown\r\n  "));
+    }
+#endif
     if (resetAbendInfo.uptime) {
         printTime(sio, PSTR("Uptime: "), resetAbendInfo.uptime);
         printTime(sio, PSTR("Time since restart: "), (time_t)(micros64() / 1000000));
@@ -498,12 +2238,53 @@ void abendInfoReport(Print& sio, bool heap) {
     if (REASON_SDK_PANIC == resetAbendInfo.reason) {
         sio.printf_P(PSTR("  SDK Panic: '%s' @0x%08x, INTLEVEL=%u\r\n"),
             resetAbendInfo.gasp, resetAbendInfo.epc1, resetAbendInfo.intlevel);
+        const char *text = resetAbendInfo.gasp;
+        #if ABENDINFO_DEFERRED_GASP
+        // Not limited by ABENDINFO_GASP_SIZE
+        char msg[128];
+        if (abendGaspFormat(resetAbendInfo, msg, sizeof(msg))) {
+            sio.printf_P(PSTR("  SDK Panic message: '%s'\r\n"), msg);
+            text = msg;
+        }
+        #endif
+        char module[sizeof(resetAbendInfo.gasp)];
+        uint32_t line;
+        if (abendParseGasp(text, module, sizeof(module), &line)) {
+            PGM_P part = abendSdkPanicModule(module);
+            sio.printf_P(PSTR("  SDK module '%s', %S, line %u\r\n"),
+                module, (part) ? part : PSTR("not in the table"), line);
+        }
     } else
     #endif
     if (REASON_USER_STACK_SMASH == resetAbendInfo.reason) {
         sio.printf_P(PSTR("  User stack smashed\r\n"));
+    #if ABENDINFO_ABORT_DETAILS
+        if (resetAbendInfo.abort_pc) {
+            // The canary check is in the epilogue of the function smashed
+            sio.printf_P(PSTR("  Stack canary check failed @0x%08x, sp 0x%08x\r\n"),
+                resetAbendInfo.abort_pc - 3u, resetAbendInfo.abort_sp);
+        }
+    #endif
     } else
     if (REASON_USER_SWEXCEPTION_RST == resetAbendInfo.reason) {
+        [[maybe_unused]] const AbendInfo& r = resetAbendInfo;
+    #if ABENDINFO_ABORT_DETAILS
+        if (ABEND_ABORT_TERMINATE == r.abort_kind) {
+            sio.printf_P(PSTR("  std::terminate() called"));
+            if (r.abort_pc) sio.printf_P(PSTR(", uncaught throw @0x%08x"), r.abort_pc - 3u);
+            sio.printf_P(PSTR(", sp 0x%08x\r\n"), r.abort_sp);
+        } else if (ABEND_ABORT_OUT_OF_MEMORY == r.abort_kind) {
+            sio.printf_P(PSTR("  Out of memory, %u bytes requested by 0x%08x, sp 0x%08x\r\n"),
+                r.alloc_size, r.alloc_pc, r.abort_sp);
+        } else
+    #endif
+    #if ABENDINFO_PANIC_NOTE
+        if (r.panic_line) {
+            // Only the copied text, the string addresses may be of another build
+            sio.printf_P(PSTR("  %S %.*s @0x%08x\r\n"), (r.panic_what) ? PSTR("Assertion failed") : PSTR("Panic"),
+                (int)sizeof(r.panic_text), r.panic_text, r.epc1);
+        } else
+    #endif
         sio.printf_P(PSTR("  User Software Exception\r\n"));
     } else
     if (is_pc_valid(epc1) && 0 == memcmp_P(infinite_loop, (PGM_VOID_P)epc1, 3u)) {
@@ -522,9 +2303,41 @@ void abendInfoReport(Print& sio, bool heap) {
     if (20u == info->exccause) {
         sio.printf_P(PSTR("  Possible source of Exception 20 @0x%08x\r\n"), epc1);
     }
+#if ABENDINFO_FAULT_ACCESS
+    else if (resetAbendInfo.insn) {
+        char text[64];
+        if (abendFaultDescribe(resetAbendInfo.insn, resetAbendInfo.epc1, resetAbendInfo.excvaddr, text, sizeof(text))) {
+            sio.printf_P(PSTR("  %s @0x%08x\r\n"), text, resetAbendInfo.epc1);
+        }
+    }
+#endif
+#if ABENDINFO_UNWIND_TABLE
+    if (resetAbendInfo.backtrace[0]) {
+        sio.printf_P(PSTR("  Backtrace:"));
+        for (size_t i = 0; i < ABENDINFO_BACKTRACE_DEPTH && resetAbendInfo.backtrace[i]; i++) {
+            sio.printf_P(PSTR(" 0x%08x"), resetAbendInfo.backtrace[i]);
+        }
+        sio.printf_P(PSTR("\r\n"));
+    } else if (REASON_EXCEPTION_RST == info->reason || REASON_SOFT_WDT_RST == info->reason) {
+        abendInfoUnwindReport(sio);
+    }
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    if (resetAbendInfo.alloc_pc && ABEND_ABORT_OUT_OF_MEMORY != resetAbendInfo.abort_kind) {
+        sio.printf_P(PSTR("  Last failed allocation: %u bytes requested by 0x%08x\r\n"),
+            resetAbendInfo.alloc_size, resetAbendInfo.alloc_pc);
+    }
+#endif
 
 #if ABENDINFO_OPTION > 0
+    abendInfoExcFrameReport(sio);
+    abendInfoStackWindowReport(sio);
+    abendInfoGaspRingReport(sio);
     if (heap) abendInfoHeapReport(sio, "Restart ", resetAbendInfo);
+    abendInfoHistoryReport(sio);
+    abendInfoFingerprintReport(sio);
+    abendInfoResetStatsReport(sio);
+    abendInfoCoreDumpReport(sio);
 #endif
 }
 
@@ -550,9 +2363,12 @@ bool abendIsHeapOK(void) {
             abendInfo.low_count = 0;
         }
         abendInfo.last = now;
+        abendUptimeMark();
     }
     // False when heap is chronically low
-    return abendInfo.low_count < kResetTriggerCount;
+    if (abendInfo.low_count < kResetTriggerCount) return true;
+    abendSetRestartCause(ABEND_RESET_HEAP_LOW);
+    return false;
 }
 #endif  // ABENDINFO_HEAP_MONITOR
 
@@ -44,10 +44,246 @@
 #define ABENDINFO_GASP_SIZE 0
 #endif
 
+#if ABENDINFO_GASP_SIZE > 255
+#error "ABENDINFO_GASP_SIZE must be less than 256"
+#endif
+
 // #if !defined(ABENDINFO_GASP_SIZE)
 // #define ABENDINFO_GASP_SIZE 64
 // #endif
 
+// Capacity of a table of SDK panic sites found by scanning code once at boot.
+// The ets_printf wrapper then tests its return address against the table
+// instead of reading the code there on every call. Set to zero to disable.
+#ifndef ABENDINFO_SDK_PANIC_INDEX
+#define ABENDINFO_SDK_PANIC_INDEX 0
+#endif
+
+// Record the format string pointer and register arguments of the last
+// ets_printf call, formatted after restart in place of the rendered text.
+#ifndef ABENDINFO_DEFERRED_GASP
+#define ABENDINFO_DEFERRED_GASP 0
+#endif
+
+// Keep the last lines of ets_printf output, each with a CPU cycle count
+// timestamp, in a .noinit ring reported after restart. The value is the size
+// of the text ring in bytes, a power of 2. Set to zero to disable.
+#ifndef ABENDINFO_GASP_RING
+#define ABENDINFO_GASP_RING 0
+#endif
+// Lines kept, a power of 2
+#ifndef ABENDINFO_GASP_LINES
+#define ABENDINFO_GASP_LINES 8
+#endif
+
+// Count ets_printf calls and characters printed by caller. The value is the
+// number of call sites tracked, a power of 2. Set to zero to disable.
+#ifndef ABENDINFO_PRINTF_HISTOGRAM
+#define ABENDINFO_PRINTF_HISTOGRAM 0
+#endif
+#if ABENDINFO_PRINTF_HISTOGRAM & (ABENDINFO_PRINTF_HISTOGRAM - 1)
+#error "ABENDINFO_PRINTF_HISTOGRAM must be a power of 2"
+#endif
+
+// Capture all ets_printf output, SDK logging included, in a RAM ring drained
+// to any Print from loop(). The value is the ring size in bytes, a power of 2.
+// Set to zero to disable.
+#ifndef ABENDINFO_LOG_RING
+#define ABENDINFO_LOG_RING 0
+#endif
+// Lines per second kept from one source, the first word of the line
+#ifndef ABENDINFO_LOG_RATE
+#define ABENDINFO_LOG_RATE 5
+#endif
+// Rate limiter slots, a power of 2. Sources hashing to a slot share its rate.
+#ifndef ABENDINFO_LOG_SOURCES
+#define ABENDINFO_LOG_SOURCES 16
+#endif
+// Place the ring in .noinit, lines not drained before a restart are kept.
+#ifndef ABENDINFO_LOG_NOINIT
+#define ABENDINFO_LOG_NOINIT 0
+#endif
+#if (ABENDINFO_LOG_RING & (ABENDINFO_LOG_RING - 1)) || 0 == ABENDINFO_LOG_SOURCES || (ABENDINFO_LOG_SOURCES & (ABENDINFO_LOG_SOURCES - 1))
+#error "ABENDINFO_LOG_RING and ABENDINFO_LOG_SOURCES must be powers of 2"
+#endif
+
+#if (ABENDINFO_GASP_RING & (ABENDINFO_GASP_RING - 1)) || 0 == ABENDINFO_GASP_LINES || (ABENDINFO_GASP_LINES & (ABENDINFO_GASP_LINES - 1))
+#error "ABENDINFO_GASP_RING and ABENDINFO_GASP_LINES must be powers of 2"
+#endif
+
+#if !ABENDINFO_IDENTIFY_SDK_PANIC
+#undef ABENDINFO_PRINTF_HISTOGRAM
+#define ABENDINFO_PRINTF_HISTOGRAM 0
+#undef ABENDINFO_LOG_RING
+#define ABENDINFO_LOG_RING 0
+#undef ABENDINFO_DEFERRED_GASP
+#define ABENDINFO_DEFERRED_GASP 0
+#undef ABENDINFO_SDK_PANIC_INDEX
+#define ABENDINFO_SDK_PANIC_INDEX 0
+#undef ABENDINFO_GASP_RING
+#define ABENDINFO_GASP_RING 0
+#endif
+
+// Number of compact crash records kept in the .noinit history ring, 4 is a
+// good start. Zero keeps only the single AbendInfo record of the previous boot.
+#ifndef ABENDINFO_HISTORY_SIZE
+#define ABENDINFO_HISTORY_SIZE 0
+#endif
+
+// Number of slots in the .noinit table of crash fingerprints. Repeats of the
+// same crash share a slot and are counted. Set to zero to disable.
+#ifndef ABENDINFO_FINGERPRINT_SIZE
+#define ABENDINFO_FINGERPRINT_SIZE 0
+#endif
+
+// Counters of restarts by cause, with cumulative uptime for MTBF. The value is
+// the number of uptime between failure samples kept for percentiles, 8 is a
+// good start. Zero disables them.
+#ifndef ABENDINFO_RESET_STATS
+#define ABENDINFO_RESET_STATS 0
+#endif
+
+// Append-only crash journal in reserved flash sectors. Written at the next
+// boot by abendHandlerInstall(), never from the crash path.
+#ifndef ABENDINFO_JOURNAL
+#define ABENDINFO_JOURNAL 0
+#endif
+
+#if ABENDINFO_JOURNAL
+#ifndef ABENDINFO_JOURNAL_ADDR
+#error "ABENDINFO_JOURNAL requires ABENDINFO_JOURNAL_ADDR, the flash offset of the sectors reserved for the journal."
+#endif
+#ifndef ABENDINFO_JOURNAL_SECTORS
+#define ABENDINFO_JOURNAL_SECTORS 2
+#endif
+#endif
+
+// Mirror reset counters and compact crash records into RTC user memory, which
+// survives deep sleep and external reset. Written once per boot by
+// abendHandlerInstall().
+#ifndef ABENDINFO_RTC_MEMORY
+#define ABENDINFO_RTC_MEMORY 0
+#endif
+
+#if ABENDINFO_RTC_MEMORY
+// Offset and size in bytes within the 512 bytes of RTC user memory, as used
+// by ESP.rtcUserMemoryWrite(). The default is the last 128 bytes, clear of
+// eboot's command block at 256 ... 383.
+#ifndef ABENDINFO_RTC_OFFSET
+#define ABENDINFO_RTC_OFFSET 384
+#endif
+#ifndef ABENDINFO_RTC_SIZE
+#define ABENDINFO_RTC_SIZE 128
+#endif
+#if (ABENDINFO_RTC_OFFSET % 4) || (ABENDINFO_RTC_SIZE % 4) || ABENDINFO_RTC_SIZE < 64 || (ABENDINFO_RTC_OFFSET + ABENDINFO_RTC_SIZE) > 512
+#error "ABENDINFO_RTC_OFFSET and ABENDINFO_RTC_SIZE must be multiples of 4, the size at least 64, and fit in 512 bytes."
+#endif
+#endif
+
+// DRAM core dump to reserved flash sectors, written from the crash callback.
+#ifndef ABENDINFO_COREDUMP
+#define ABENDINFO_COREDUMP 0
+#endif
+
+#if ABENDINFO_COREDUMP
+#ifndef ABENDINFO_COREDUMP_ADDR
+#error "ABENDINFO_COREDUMP requires ABENDINFO_COREDUMP_ADDR, the flash offset of the sectors reserved for the core dump."
+#endif
+// 24 sectors holds all of DRAM, 80K
+#ifndef ABENDINFO_COREDUMP_SECTORS
+#define ABENDINFO_COREDUMP_SECTORS 24
+#endif
+// What to dump, see ABENDINFO_COREDUMP_... region bits below
+#ifndef ABENDINFO_COREDUMP_REGIONS
+#define ABENDINFO_COREDUMP_REGIONS 0x0f
+#endif
+// Stop dumping after this many milliseconds, well inside the HW WDT timeout.
+#ifndef ABENDINFO_COREDUMP_BUDGET_MS
+#define ABENDINFO_COREDUMP_BUDGET_MS 500
+#endif
+// Size of the static RAM buffer DRAM is copied through, a multiple of 4
+#ifndef ABENDINFO_COREDUMP_BUFFER
+#define ABENDINFO_COREDUMP_BUFFER 256
+#endif
+// Compress segments with AbendLz. Costs about 2K of static DRAM for the
+// encoder, stacks and heap typically shrink 3 to 5 times.
+#ifndef ABENDINFO_COREDUMP_COMPRESS
+#define ABENDINFO_COREDUMP_COMPRESS 0
+#endif
+#endif
+#define ABENDINFO_COREDUMP_STACKS 0x01   // Crash stack and the CONT stack
+#define ABENDINFO_COREDUMP_DATA   0x02   // .data, .rodata, and .bss
+#define ABENDINFO_COREDUMP_HEAP   0x04   // umm_malloc heap with its metadata
+#define ABENDINFO_COREDUMP_SYS    0x08   // SDK data and SYS stack, 0x3FFFC000 up
+
+// Save excvaddr and the instruction at epc1 of a load or store exception in
+// the crash record. The report describes the access, eg. "32-bit store to
+// 0x00000000 via a3+0".
+#ifndef ABENDINFO_FAULT_ACCESS
+#define ABENDINFO_FAULT_ACCESS 0
+#endif
+
+// Save the exception frame, a0 ... a15 and the exception special registers,
+// of a crash in .noinit, reported after restart.
+#ifndef ABENDINFO_EXC_FRAME
+#define ABENDINFO_EXC_FRAME 0
+#endif
+
+// Entries reserved in flash for the call0 unwind table filled in by
+// tools/abendunwind.cpp after linking, about one per function. With the table
+// filled, the crash callback saves a backtrace in the crash record. Set to
+// zero to disable.
+#ifndef ABENDINFO_UNWIND_TABLE
+#define ABENDINFO_UNWIND_TABLE 0
+#endif
+
+// Stack words saved from the crash stack pointer up, run-length encoded in
+// .noinit, for offline symbolization with tools/abendstack.cpp. Set to zero
+// to disable.
+#ifndef ABENDINFO_STACK_WINDOW
+#define ABENDINFO_STACK_WINDOW 0
+#endif
+#if ABENDINFO_STACK_WINDOW
+// Words of .noinit for the encoded window, a window that does not fit is cut
+// short. The default always fits.
+#ifndef ABENDINFO_STACK_WINDOW_AREA
+#define ABENDINFO_STACK_WINDOW_AREA (ABENDINFO_STACK_WINDOW + 1)
+#endif
+// Keep only the words that look like code addresses, the others are saved
+// as 0 and mostly encode as runs.
+#ifndef ABENDINFO_STACK_WINDOW_FILTER
+#define ABENDINFO_STACK_WINDOW_FILTER 1
+#endif
+#endif
+
+// Note the file, line, and function of panic() and of a failed assert() in
+// the crash record. Wraps the core's panic() and assert() macros for the
+// sources that include AbendInfo.h.
+#ifndef ABENDINFO_PANIC_NOTE
+#define ABENDINFO_PANIC_NOTE 0
+#endif
+
+// Note the details of a stack smash, a std::terminate(), or an abort after a
+// failed allocation in the crash record: the caller, the size requested, and
+// the stack pointer.
+#ifndef ABENDINFO_ABORT_DETAILS
+#define ABENDINFO_ABORT_DETAILS 0
+#endif
+
+// Count calls and CPU cycles of recoverable exception handlers, eg. the
+// core's LoadStoreError handler. The value is the number of exception causes
+// tracked. Set to zero to disable.
+#ifndef ABENDINFO_EXC_STATS
+#define ABENDINFO_EXC_STATS 0
+#endif
+
+// Emulate unaligned 16 and 32-bit loads and stores, EXCCAUSE 9, instead of
+// crashing. The value is the number of faulting PCs counted. Set to zero to
+// disable.
+#ifndef ABENDINFO_UNALIGNED
+#define ABENDINFO_UNALIGNED 0
+#endif
+
 #ifndef ABENDINFO_HEAP_MONITOR
 #ifdef UMM_STATS_FULL
 #define ABENDINFO_HEAP_MONITOR 1
@@ -68,8 +304,52 @@
 #endif
 extern "C" void SHARE_CUSTOM_CRASH_CB__DEBUG_ESP_ABENDINFO(struct rst_info * rst_info, uint32_t stack, uint32_t stack_end);
 
+// True when .noinit DRAM held through the reset of rst_info reason. It does
+// not through power on, deep sleep, or external reset.
+static inline bool isNoinitHeld(uint32_t reason) {
+    return REASON_WDT_RST == reason || REASON_EXCEPTION_RST == reason ||
+           REASON_SOFT_WDT_RST == reason || REASON_SOFT_RESTART == reason;
+}
+
+
+/*
+  Layout version of struct AbendInfo. Bump when fields are added, removed, or
+  reordered, and teach abendInfoMigrate() in AbendHandler.cpp to read the
+  previous layout. Layout options present in a record are described by
+  `flags` and `gasp_size`, so a record written by a build with different
+  options can still be read.
+*/
+#define ABENDINFO_SCHEMA 1
+#define ABENDINFO_MAGIC  0x49424e41u    // "ANBI"
+#define ABENDINFO_LAYOUT_HEAP_MONITOR  0x01u
+#define ABENDINFO_LAYOUT_SDK_PANIC     0x02u
+#define ABENDINFO_LAYOUT_DEFERRED_GASP 0x04u
+#define ABENDINFO_LAYOUT_FAULT_ACCESS  0x08u
+#define ABENDINFO_LAYOUT_BACKTRACE     0x10u
+#define ABENDINFO_LAYOUT_PANIC_NOTE    0x20u
+#define ABENDINFO_LAYOUT_ABORT         0x40u
+// ets_printf arguments after the format passed in registers, a3 ... a7
+#define ABENDINFO_GASP_ARGS 5
+// Return addresses kept in the crash record
+#define ABENDINFO_BACKTRACE_DEPTH 16
+// "file:line" of a panic() or assert() copied into the crash record
+#define ABENDINFO_PANIC_TEXT 32
+
+// How a user software exception or stack smash came about
+enum AbendAbortKind : uint32_t {
+    ABEND_ABORT_NONE = 0,
+    ABEND_ABORT_STACK_SMASH,    // __stack_chk_fail(), a stack canary was overwritten
+    ABEND_ABORT_TERMINATE,      // std::terminate(), eg. an uncaught exception
+    ABEND_ABORT_OUT_OF_MEMORY,  // abort after a failed allocation, eg. operator new
+};
 
 struct AbendInfo {
+    uint32_t magic;     // ABENDINFO_MAGIC
+    uint16_t schema;    // ABENDINFO_SCHEMA
+    uint16_t size;      // sizeof(struct AbendInfo) of the writer
+    uint8_t  flags;     // ABENDINFO_LAYOUT_... options present
+    uint8_t  gasp_size;
+    uint16_t reserved[3];
     time_t uptime;
     uint32_t reason;
     uint32_t exccause;
@@ -85,6 +365,31 @@ struct AbendInfo {
     uint32_t intlevel;
     size_t   idx;
     char     gasp[ABENDINFO_GASP_SIZE];  // Buffer last ets_printf message - last gasp
+#endif
+#if ABENDINFO_DEFERRED_GASP
+    uint32_t fmt;       // Format string of the last ets_printf call
+    uint32_t args[ABENDINFO_GASP_ARGS];
+#endif
+#if ABENDINFO_FAULT_ACCESS
+    uint32_t excvaddr;
+    uint32_t insn;      // at epc1 of a load or store exception, else 0
+#endif
+#if ABENDINFO_UNWIND_TABLE
+    uint32_t backtrace[ABENDINFO_BACKTRACE_DEPTH];  // return addresses, 0 after the last
+#endif
+#if ABENDINFO_PANIC_NOTE
+    uint32_t panic_file;    // Strings given to panic() or assert(), only valid
+    uint32_t panic_func;    // in the build that crashed
+    uint32_t panic_what;    // Failed assert() expression, else 0
+    uint32_t panic_line;    // 0 when no panic() or assert() was noted
+    char     panic_text[ABENDINFO_PANIC_TEXT];  // "file:line func", base name of the file
+#endif
+#if ABENDINFO_ABORT_DETAILS
+    uint32_t abort_kind;    // AbendAbortKind
+    uint32_t abort_pc;      // Return address of the call to __stack_chk_fail or __cxa_throw
+    uint32_t abort_sp;      // Stack pointer at the crash callback
+    uint32_t alloc_pc;      // Caller of the last failed allocation, 0 when none failed
+    uint32_t alloc_size;    // Bytes requested
 #endif
     uint32_t crc;   // Must be last element
 };
@@ -93,6 +398,336 @@ extern AbendInfo resetAbendInfo;
 extern "C" void abendHandlerInstall(bool update=false);
 void abendInfoHeapReport(Print& sio, const char *qualifier="", AbendInfo& info=abendInfo);
 
+// Compact encoding of info, see AbendCodec.h. Returns the number of bytes
+// written or 0 when buf is too small.
+size_t abendInfoEncode(const AbendInfo& info, uint8_t *buf, size_t len);
+
+#if ABENDINFO_IDENTIFY_SDK_PANIC
+// Parse last gasp text "module line", the module for abendSdkPanicModule().
+bool abendParseGasp(const char *gasp, char *module, size_t size, uint32_t *line);
+// Returns the part of the SDK a panic module belongs to, in flash, or NULL.
+// Only the module is named, the line of an SDK panic is not described.
+PGM_P abendSdkPanicModule(const char *module);
+#endif
+
+#if ABENDINFO_DEFERRED_GASP
+// Formats the ets_printf call recorded in info. Returns the length, or 0 when
+// no format was recorded or it is no longer readable.
+size_t abendGaspFormat(const AbendInfo& info, char *buf, size_t size);
+#endif
+
+#if ABENDINFO_SDK_PANIC_INDEX
+/*
+  Return addresses of the `ets_printf(...); while (true) {}` sites in IRAM and
+  flash code, sorted. The ets_printf wrapper tests bit n of the bitmap, n being
+  bits 10:0 of its return address, and only searches site[] when it is set.
+*/
+struct AbendSdkPanicIndex {
+    uint8_t  bitmap[256];   // Must be first element, l8ui offsets are 0 ... 255
+    uint32_t count;         // 0 until built or when the table is too small
+    uint32_t found;         // Sites found by the scan
+    uint32_t cycles;        // Spent scanning
+    uint32_t site[ABENDINFO_SDK_PANIC_INDEX];
+};
+extern AbendSdkPanicIndex abendSdkPanicIndex;
+// Called from abendHandlerInstall().
+void abendSdkPanicIndexBuild(void);
+extern "C" bool abendSdkPanicSiteFind(uint32_t ret);
+// Prints the sites found and the ets_printf cost with and without the index.
+void abendInfoSdkPanicIndexReport(Print& sio);
+#else
+static inline void abendInfoSdkPanicIndexReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_GASP_RING
+// Prints the lines of ets_printf output kept from before the restart.
+void abendInfoGaspRingReport(Print& sio);
+#else
+static inline void abendInfoGaspRingReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_PRINTF_HISTOGRAM
+/*
+  ets_printf calls and characters by return address, an open addressed hash
+  updated by the ets_printf wrapper. Output of the SDK's os_printf does not
+  pass through the wrapper, it is only counted in chars.
+*/
+struct AbendPrintfSite {
+    uint32_t pc;        // return address of the call, 0 for a free entry
+    uint32_t fmt;       // format string of the first call seen
+    uint32_t calls;
+    uint32_t bytes;
+};
+struct AbendPrintfStats {
+    uint32_t chars;     // Must be first element, all characters through putc2
+    uint32_t fmt;       // Format of the call in progress
+    uint32_t counted;   // chars attributed to a site
+    uint32_t missed;    // calls with no free entry
+    AbendPrintfSite site[ABENDINFO_PRINTF_HISTOGRAM];
+};
+extern AbendPrintfStats abendPrintfStats;
+extern "C" void abendPrintfCount(uint32_t pc, uint32_t chars_at_entry);
+// Lists the top call sites and the top modules, the first word of the
+// format, by characters printed.
+void abendInfoPrintfReport(Print& sio, size_t count=8);
+#else
+static inline void abendInfoPrintfReport([[maybe_unused]] Print& sio, [[maybe_unused]] size_t count=8) {}
+#endif
+
+#if ABENDINFO_LOG_RING
+// Bytes of complete lines waiting in the log ring.
+size_t abendLogAvailable(void);
+// Call from loop(). Writes up to max bytes of logged lines to out, with a
+// note of lines dropped since the last call. Returns the bytes written.
+size_t abendLogDrain(Print& out, size_t max=SIZE_MAX);
+#else
+static inline size_t abendLogAvailable(void) { return 0; }
+static inline size_t abendLogDrain([[maybe_unused]] Print& out, [[maybe_unused]] size_t max=SIZE_MAX) { return 0; }
+#endif
+
+#if ABENDINFO_HISTORY_SIZE
+/*
+  Compact crash record kept in the .noinit history ring. One is added at each
+  pass through the custom crash callback. A record with a seq of 0 is empty.
+*/
+struct AbendRecord {
+    uint32_t seq;       // Increments with each crash recorded
+    uint32_t uptime;    // in seconds
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t oom;
+    uint32_t crc;       // Must be last element
+};
+// age 0 is the most recent crash. Returns NULL when there is no record.
+const AbendRecord *abendHistoryRecord(size_t age);
+void abendInfoHistoryReport(Print& sio);
+#else
+static inline void abendInfoHistoryReport([[maybe_unused]] Print& sio) {}
+#endif
+
+/*
+  Restart causes counted by the reset statistics. Heap low and network health
+  restarts are requested by the Sketch, with panic() or ESP.restart(), after
+  abendIsHeapOK() or abendIsNetworkOK() returns false. Out of memory is an
+  abort after a failed allocation, told apart with ABENDINFO_ABORT_DETAILS.
+*/
+enum AbendResetCause {
+    ABEND_RESET_EXCEPTION = 0,
+    ABEND_RESET_SDK_PANIC,
+    ABEND_RESET_SOFT_WDT,
+    ABEND_RESET_HARDWARE_WDT,
+    ABEND_RESET_USER_PANIC,
+    ABEND_RESET_NETWORK,
+    ABEND_RESET_HEAP_LOW,
+    ABEND_RESET_STACK_SMASH,
+    ABEND_RESET_OUT_OF_MEMORY,
+    ABEND_RESET_CAUSES
+};
+
+#if ABENDINFO_RESET_STATS
+// Count of restarts for cause, over all boots since the counters were cleared.
+uint32_t abendResetCount(AbendResetCause cause);
+// Mark the next restart, when it is panic() or ESP.restart(), as caused by cause.
+void abendSetRestartCause(AbendResetCause cause);
+/*
+  Save the current uptime, so a boot ending without the crash callback, eg.
+  Hardware WDT or external reset, still adds to the cumulative uptime. Called
+  by abendIsHeapOK(). Without ABENDINFO_HEAP_MONITOR, call it from loop().
+*/
+void abendUptimeMark(void);
+void abendInfoResetStatsReport(Print& sio);
+#else
+static inline uint32_t abendResetCount([[maybe_unused]] AbendResetCause cause) { return 0; }
+static inline void abendSetRestartCause([[maybe_unused]] AbendResetCause cause) {}
+static inline void abendUptimeMark(void) {}
+static inline void abendInfoResetStatsReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_FINGERPRINT_SIZE
+/*
+  Crash fingerprint table entry. The fingerprint is a hash of reason,
+  exccause, epc1, and the normalized last gasp text. A fingerprint of 0 marks
+  an empty slot.
+*/
+struct AbendFingerprint {
+    uint32_t fingerprint;
+    uint32_t count;
+    uint32_t first;     // uptime, in seconds, at the first occurrence
+    uint32_t last;      // uptime, in seconds, at the most recent occurrence
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    char     gasp[12];  // Leading part of the last gasp text
+};
+// Copies up to n entries, most frequent first. Returns the number copied.
+size_t abendFingerprintTop(AbendFingerprint *top, size_t n);
+void abendInfoFingerprintReport(Print& sio, size_t top=5);
+#else
+static inline void abendInfoFingerprintReport([[maybe_unused]] Print& sio, [[maybe_unused]] size_t top=5) {}
+#endif
+
+#if ABENDINFO_JOURNAL
+#include "AbendJournal.h"
+// age 0 is the most recent record in the flash journal.
+bool abendJournalGet(size_t age, AbendJournalRecord *rec);
+void abendInfoJournalReport(Print& sio, size_t count=8);
+#else
+static inline void abendInfoJournalReport([[maybe_unused]] Print& sio, [[maybe_unused]] size_t count=8) {}
+#endif
+
+#if ABENDINFO_COREDUMP
+#include "AbendCoreDump.h"
+// Called from the crash callback.
+void abendCoreDumpWrite(struct rst_info *rst_info, uint32_t stack, uint32_t stack_end);
+// Reads the header of the dump in flash. Returns true for a complete dump.
+bool abendCoreDumpHeader(AbendCoreDumpHeader *hdr);
+// Erase the region, ready for the next crash. Takes several hundred ms.
+bool abendCoreDumpErase(void);
+void abendInfoCoreDumpReport(Print& sio);
+#else
+static inline void abendInfoCoreDumpReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_RTC_MEMORY
+#include "AbendCodec.h"
+// Boots counted by rst_info reason, REASON_DEFAULT_RST ... REASON_EXT_SYS_RST
+uint32_t abendRtcResetCount(uint32_t reason);
+// age 0 is the most recent crash record in RTC memory.
+bool abendRtcRecord(size_t age, AbendCodecRecord *rec);
+void abendInfoRtcReport(Print& sio);
+#else
+static inline void abendInfoRtcReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_UNALIGNED || ABENDINFO_FAULT_ACCESS
+constexpr uint8_t kAbendAccessLiteral = 0xffu;
+// A load or store instruction
+struct AbendAccess {
+    uint8_t  width;     // bytes
+    bool     store;
+    bool     sign;      // sign extending load
+    uint8_t  len;       // instruction bytes
+    uint8_t  reg;       // register loaded or stored
+    uint8_t  base;      // address register, kAbendAccessLiteral for l32r
+    int32_t  offset;    // added to base
+};
+uint32_t abendFetchInsn(uint32_t pc);
+// Returns false for an instruction that is not a load or store.
+bool abendDecodeAccess(uint32_t insn, AbendAccess *access);
+#endif
+#if ABENDINFO_FAULT_ACCESS
+// Describes the faulting access, eg. "32-bit store to 0x00000000 via a3+0".
+// Returns the length of the text, 0 when insn is not a load or store.
+size_t abendFaultDescribe(uint32_t insn, uint32_t pc, uint32_t excvaddr, char *buf, size_t size);
+#endif
+
+#if ABENDINFO_UNALIGNED || ABENDINFO_EXC_FRAME
+// Returns the stack pointer of an exception that the handlers of
+// AbendException.cpp passed to the SDK's fatal handler, else stack.
+uint32_t abendExcStack(uint32_t stack);
+#endif
+
+#if ABENDINFO_EXC_FRAME
+struct AbendExcFrame {
+    uint32_t magic;
+    uint32_t cause;
+    uint32_t epc1;
+    uint32_t ps;
+    uint32_t sar;
+    uint32_t excvaddr;
+    uint32_t excsave1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t depc;
+    uint32_t a[16];     // a1 is the stack pointer of the exception
+    uint32_t stack;     // 0 when the crash callback did not run
+    uint32_t stack_end;
+};
+// Frame of the current boot's crash, if any
+extern AbendExcFrame abendExcFrame;
+void abendExcFrameInit(uint32_t reason);
+void abendExcFrameInstall(void);
+void abendExcFrameSeal(uint32_t stack, uint32_t stack_end);
+void abendInfoExcFrameReport(Print& sio);
+#else
+static inline void abendInfoExcFrameReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_UNWIND_TABLE
+/*
+  Unwinds a call0 stack with the table from tools/abendunwind.cpp. pc is 0
+  after a call to an invalid address, a0 is then the first return address.
+  a0 is used for the return of the top frame when it has not saved it. Saves
+  up to max return addresses in ret and returns the number saved.
+*/
+size_t abendUnwind(uint32_t pc, uint32_t a0, uint32_t sp, uint32_t stack_end, uint32_t *ret, size_t max);
+// Notes an unwind table that was not filled in
+void abendInfoUnwindReport(Print& sio);
+#endif
+
+#if ABENDINFO_PANIC_NOTE
+/*
+  Note the details of a panic() or a failed assert() in abendInfo, then call
+  the core's __panic_func() or __assert_func(). The caller becomes epc1 of
+  the crash record. The core's own panic() and assert() calls are not noted,
+  nor are those of sources that include <assert.h> again after this file.
+*/
+extern "C" void abendPanic(const char *file, int line, const char *func) __attribute__((noreturn));
+extern "C" void abendAssert(const char *file, int line, const char *func, const char *what) __attribute__((noreturn));
+
+#undef panic
+#define panic() abendPanic(PSTR(__FILE__), __LINE__, __func__)
+#ifndef NDEBUG
+#include <assert.h>
+#undef assert
+#define assert(e) ((e) ? (void)0 : abendAssert(PSTR(__FILE__), __LINE__, __func__, PSTR(#e)))
+#endif
+#endif
+
+#if ABENDINFO_STACK_WINDOW
+// Prints the stack window saved by the last crash, the input of
+// tools/abendstack.cpp.
+void abendInfoStackWindowReport(Print& sio);
+#else
+static inline void abendInfoStackWindowReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_EXC_STATS
+struct AbendExcStats {
+    uint32_t cause;         // EXCCAUSE
+    uint32_t count;         // calls of the handler
+    uint32_t cycles_max;    // longest call, CPU cycles
+    uint64_t cycles;        // all calls, CPU cycles
+};
+// Wraps the C exception handlers installed so far. Called by
+// abendHandlerInstall(), call again after installing another handler.
+void abendExcStatsInstall(void);
+// Copies up to n entries, one per exception cause wrapped, returns the number
+// copied.
+size_t abendExcStatsGet(AbendExcStats *stats, size_t n);
+void abendExcStatsReset(void);
+void abendInfoExcStatsReport(Print& sio);
+#else
+static inline void abendInfoExcStatsReport([[maybe_unused]] Print& sio) {}
+#endif
+
+#if ABENDINFO_UNALIGNED
+struct AbendUnalignedSite {
+    uint32_t pc;        // of the unaligned load or store
+    uint32_t addr;      // last address accessed
+    uint32_t count;     // times emulated
+};
+// Installs the EXCCAUSE 9 handler, called by abendHandlerInstall(). A C
+// handler already on cause 9 is chained to for what is not emulated.
+void abendUnalignedInstall(void);
+// Copies up to n sites, most frequent first, returns the number copied.
+size_t abendUnalignedTop(AbendUnalignedSite *top, size_t n);
+void abendInfoUnalignedReport(Print& sio);
+#else
+static inline void abendInfoUnalignedReport([[maybe_unused]] Print& sio) {}
+#endif
+
 #else  // ABENDINFO_OPTION
 #undef ABENDINFO_REPLACE_ALL_DEFAULT_EXC_HANDLERS
 #define ABENDINFO_REPLACE_ALL_DEFAULT_EXC_HANDLERS 0
@@ -106,7 +741,82 @@ void abendInfoHeapReport(Print& sio, const char *qualifier="", AbendInfo& info=a
 #undef SHARE_CUSTOM_CRASH_CB__DEBUG_ESP_ABENDINFO
 #define SHARE_CUSTOM_CRASH_CB__DEBUG_ESP_ABENDINFO(...);
 
+#undef ABENDINFO_HISTORY_SIZE
+#define ABENDINFO_HISTORY_SIZE 0
+
+#undef ABENDINFO_JOURNAL
+#define ABENDINFO_JOURNAL 0
+
+#undef ABENDINFO_FINGERPRINT_SIZE
+#define ABENDINFO_FINGERPRINT_SIZE 0
+
+#undef ABENDINFO_RTC_MEMORY
+#define ABENDINFO_RTC_MEMORY 0
+
+#undef ABENDINFO_RESET_STATS
+#define ABENDINFO_RESET_STATS 0
+
+#undef ABENDINFO_COREDUMP
+#define ABENDINFO_COREDUMP 0
+
+#undef ABENDINFO_SDK_PANIC_INDEX
+#define ABENDINFO_SDK_PANIC_INDEX 0
+
+#undef ABENDINFO_GASP_RING
+#define ABENDINFO_GASP_RING 0
+
+#undef ABENDINFO_DEFERRED_GASP
+#define ABENDINFO_DEFERRED_GASP 0
+
+#undef ABENDINFO_LOG_RING
+#define ABENDINFO_LOG_RING 0
+
+#undef ABENDINFO_PRINTF_HISTOGRAM
+#define ABENDINFO_PRINTF_HISTOGRAM 0
+
+#undef ABENDINFO_EXC_STATS
+#define ABENDINFO_EXC_STATS 0
+
+#undef ABENDINFO_FAULT_ACCESS
+#define ABENDINFO_FAULT_ACCESS 0
+
+#undef ABENDINFO_EXC_FRAME
+#define ABENDINFO_EXC_FRAME 0
+
+#undef ABENDINFO_UNWIND_TABLE
+#define ABENDINFO_UNWIND_TABLE 0
+
+#undef ABENDINFO_STACK_WINDOW
+#define ABENDINFO_STACK_WINDOW 0
+
+#undef ABENDINFO_PANIC_NOTE
+#define ABENDINFO_PANIC_NOTE 0
+
+#undef ABENDINFO_ABORT_DETAILS
+#define ABENDINFO_ABORT_DETAILS 0
+
+#undef ABENDINFO_UNALIGNED
+#define ABENDINFO_UNALIGNED 0
+
 #define abendInfoHeapReport(...)
+#define abendInfoHistoryReport(...)
+#define abendInfoJournalReport(...)
+#define abendInfoFingerprintReport(...)
+#define abendInfoRtcReport(...)
+#define abendInfoResetStatsReport(...)
+#define abendInfoCoreDumpReport(...)
+#define abendInfoSdkPanicIndexReport(...)
+#define abendInfoGaspRingReport(...)
+#define abendLogAvailable(...) (0u)
+#define abendLogDrain(...) (0u)
+#define abendInfoPrintfReport(...)
+#define abendInfoExcStatsReport(...)
+#define abendInfoUnalignedReport(...)
+#define abendInfoExcFrameReport(...)
+#define abendInfoStackWindowReport(...)
+#define abendResetCount(...) (0u)
+#define abendSetRestartCause(...)
+#define abendUptimeMark(...)
 static inline void abendHandlerInstall([[maybe_unused]] bool update=false; ) {}
 #endif   // ABENDINFO_OPTION
 
@@ -0,0 +1,197 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Append-only crash journal in a reserved flash region
+ *
+ * Sector layout:
+ *   +0   AbendJournalSector header
+ *   +16  AbendJournalRecord slots, filled in order, erased slots read 0xFF
+ *
+ * A sector header carries the seq of the first record slot in the sector.
+ * A record's seq is fixed by its position, slot k holds first_seq + k. A
+ * torn record write costs that one slot; it fails its CRC check and its seq
+ * is not reused. With this rule, any record is found by arithmetic from the
+ * active sector's header and used slot count.
+ *
+ * A torn sector rotation, erased with no header written, leaves the sector
+ * invalid. The previous sector remains active and the next append repeats
+ * the rotation.
+ */
+#include "AbendJournal.h"
+#include <string.h>
+
+constexpr uint32_t kJournalSectorMagic = 0x4a424e41u;  // "ANBJ"
+constexpr uint32_t kJournalRecordMagic = 0x52424e41u;  // "ANBR"
+constexpr uint32_t kErased = 0xffffffffu;
+
+struct AbendJournalSector {
+    uint32_t magic;
+    uint32_t seq;         // Increments with each sector rotation, never 0
+    uint32_t first_seq;   // seq of the record in slot 0
+    uint32_t crc;         // Must be last element
+};
+
+static_assert(sizeof(AbendJournalRecord) == 64, "Keep record slots at 64 bytes");
+static_assert(0 == sizeof(AbendJournalSector) % 4, "Flash access must be 32-bit aligned");
+
+/*
+  Same algorithm as the Arduino ESP8266 Core's crc32(), so values agree with
+  those computed on the device and on the host.
+*/
+uint32_t abendJournalCrc32(const void *data, size_t length, uint32_t crc) {
+    const uint8_t *ldata = (const uint8_t *)data;
+    while (length--) {
+        uint8_t c = *ldata++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1) {
+            bool bit = crc & 0x80000000u;
+            if (c & i) {
+                bit = !bit;
+            }
+            crc <<= 1;
+            if (bit) {
+                crc ^= 0x04c11db7u;
+            }
+        }
+    }
+    return crc;
+}
+
+static inline uint32_t slotsPerSector(const AbendJournal *j) {
+    return (j->sector_size - sizeof(AbendJournalSector)) / sizeof(AbendJournalRecord);
+}
+
+static inline uint32_t sectorAddr(const AbendJournal *j, uint32_t sector) {
+    return j->base + sector * j->sector_size;
+}
+
+static inline uint32_t slotAddr(const AbendJournal *j, uint32_t sector, uint32_t slot) {
+    return sectorAddr(j, sector) + sizeof(AbendJournalSector) + slot * sizeof(AbendJournalRecord);
+}
+
+static bool readSector(const AbendJournal *j, uint32_t sector, AbendJournalSector *hdr) {
+    if (! j->flash.read(sectorAddr(j, sector), hdr, sizeof(AbendJournalSector))) return false;
+    return kJournalSectorMagic == hdr->magic && 0 != hdr->seq &&
+           hdr->crc == abendJournalCrc32(hdr, offsetof(AbendJournalSector, crc));
+}
+
+static bool isSlotUsed(const AbendJournal *j, uint32_t sector, uint32_t slot) {
+    uint32_t magic = kErased;
+    j->flash.read(slotAddr(j, sector, slot), &magic, sizeof(magic));
+    return kErased != magic;
+}
+
+bool abendJournalMount(AbendJournal *j) {
+    j->mounted = false;
+    if (j->sectors < 2 || 0 == j->sector_size || 0 == slotsPerSector(j) ||
+        !j->flash.read || !j->flash.write || !j->flash.erase) {
+        return false;
+    }
+
+    // Newest valid sector header is the active sector
+    AbendJournalSector active = {};
+    j->active = j->sectors - 1;
+    j->active_seq = 0;
+    for (uint32_t s = 0; s < j->sectors; s++) {
+        AbendJournalSector hdr;
+        if (readSector(j, s, &hdr) && hdr.seq > j->active_seq) {
+            j->active = s;
+            j->active_seq = hdr.seq;
+            active = hdr;
+        }
+    }
+
+    j->used = 0;
+    j->latest_seq = 0;
+    if (j->active_seq) {
+        // Slots are filled in order. Binary search for the first erased slot.
+        uint32_t lo = 0;
+        uint32_t hi = slotsPerSector(j);
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (isSlotUsed(j, j->active, mid)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        j->used = lo;
+        j->latest_seq = active.first_seq + j->used - 1;
+    }
+    j->mounted = true;
+    return true;
+}
+
+static bool rotate(AbendJournal *j) {
+    uint32_t next = (j->active_seq) ? (j->active + 1) % j->sectors : 0;
+    AbendJournalSector hdr;
+    hdr.magic     = kJournalSectorMagic;
+    hdr.seq       = j->active_seq + 1;
+    hdr.first_seq = j->latest_seq + 1;
+    hdr.crc       = abendJournalCrc32(&hdr, offsetof(AbendJournalSector, crc));
+    if (! j->flash.erase(sectorAddr(j, next))) return false;
+    if (! j->flash.write(sectorAddr(j, next), &hdr, sizeof(hdr))) return false;
+    j->active = next;
+    j->active_seq = hdr.seq;
+    j->used = 0;
+    return true;
+}
+
+/*
+  Fills in magic, seq, and crc of rec and appends it to the journal.
+*/
+bool abendJournalAppend(AbendJournal *j, AbendJournalRecord *rec) {
+    if (! j->mounted) return false;
+    if (0 == j->active_seq || slotsPerSector(j) <= j->used) {
+        if (! rotate(j)) return false;
+    }
+    rec->magic = kJournalRecordMagic;
+    rec->seq   = j->latest_seq + 1;
+    rec->gasp[sizeof(rec->gasp) - 1] = '\0';
+    rec->crc   = abendJournalCrc32(rec, offsetof(AbendJournalRecord, crc));
+    uint32_t addr = slotAddr(j, j->active, j->used);
+    // The slot is consumed even when the write fails part way
+    j->used++;
+    j->latest_seq++;
+    return j->flash.write(addr, rec, sizeof(AbendJournalRecord));
+}
+
+uint32_t abendJournalCount(const AbendJournal *j) {
+    if (! j->mounted) return 0;
+    uint32_t capacity = j->used + (j->sectors - 1) * slotsPerSector(j);
+    return (j->latest_seq < capacity) ? j->latest_seq : capacity;
+}
+
+bool abendJournalRead(const AbendJournal *j, uint32_t age, AbendJournalRecord *rec) {
+    if (age >= abendJournalCount(j)) return false;
+
+    uint32_t sector = j->active;
+    uint32_t slot;
+    if (age < j->used) {
+        slot = j->used - 1 - age;
+    } else {
+        // Sectors behind the active sector are always full
+        const uint32_t slots = slotsPerSector(j);
+        uint32_t back = 1 + (age - j->used) / slots;
+        slot = slots - 1 - (age - j->used) % slots;
+        sector = (j->active + j->sectors - back) % j->sectors;
+        AbendJournalSector hdr;
+        if (! readSector(j, sector, &hdr) || hdr.seq != j->active_seq - back) return false;
+    }
+    if (! j->flash.read(slotAddr(j, sector, slot), rec, sizeof(AbendJournalRecord))) return false;
+    return kJournalRecordMagic == rec->magic &&
+           j->latest_seq - age == rec->seq &&
+           rec->crc == abendJournalCrc32(rec, offsetof(AbendJournalRecord, crc));
+}
@@ -0,0 +1,86 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Append-only crash journal in a reserved flash region
+ *
+ * Summary:
+ *   * Records are appended to the active sector. When it fills, the next
+ *     sector in the region is erased and becomes active. Sectors are used
+ *     round-robin, spreading erase cycles evenly over the region.
+ *   * At mount, only the sector headers and a binary search of the active
+ *     sector are read. The resulting in-RAM index locates the latest record,
+ *     and any older record, without scanning the region.
+ *
+ * This module has no Arduino dependencies. Flash access is supplied by the
+ * caller through AbendJournalFlash. On the device AbendHandler.cpp supplies
+ * the spi_flash_... functions. On a Linux host a file may be used to emulate
+ * the flash, see tools/abendjournal.cpp.
+ */
+#ifndef ABENDJOURNAL_H_
+#define ABENDJOURNAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef ABENDINFO_JOURNAL_GASP_SIZE
+#define ABENDINFO_JOURNAL_GASP_SIZE 32
+#endif
+
+// Flash access. addr, buffer and len are multiples of 4. Return true on
+// success.
+struct AbendJournalFlash {
+    bool (*read)(uint32_t addr, void *buf, size_t len);
+    bool (*write)(uint32_t addr, const void *buf, size_t len);
+    bool (*erase)(uint32_t addr);   // erase the sector starting at addr
+};
+
+// Fixed size so it can be located by arithmetic. 64 bytes
+struct AbendJournalRecord {
+    uint32_t magic;
+    uint32_t seq;       // Increments with each record appended, never 0
+    uint32_t uptime;    // in seconds
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t oom;
+    char     gasp[ABENDINFO_JOURNAL_GASP_SIZE];
+    uint32_t crc;       // Must be last element
+};
+
+struct AbendJournal {
+    // Set by caller before abendJournalMount()
+    AbendJournalFlash flash;
+    uint32_t base;          // Flash offset of the region, sector aligned
+    uint32_t sectors;       // Number of sectors in the region, 2 or more
+    uint32_t sector_size;
+    // In-RAM index built by abendJournalMount()
+    uint32_t active;        // Sector receiving appends
+    uint32_t active_seq;    // Sector sequence number of the active sector
+    uint32_t used;          // Record slots used in the active sector
+    uint32_t latest_seq;    // seq of the latest record, 0 when empty
+    bool     mounted;
+};
+
+bool abendJournalMount(AbendJournal *j);
+bool abendJournalAppend(AbendJournal *j, AbendJournalRecord *rec);
+// age 0 is the latest record. Returns false when the record is not available
+// or fails its CRC check.
+bool abendJournalRead(const AbendJournal *j, uint32_t age, AbendJournalRecord *rec);
+// Number of records that can be read back, at most the region capacity.
+uint32_t abendJournalCount(const AbendJournal *j);
+uint32_t abendJournalCrc32(const void *data, size_t length, uint32_t crc = 0xffffffff);
+
+#endif // ABENDJOURNAL_H_
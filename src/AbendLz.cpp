@@ -0,0 +1,183 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Streaming LZSS compressor with fixed memory
+ *
+ * The input buffer holds two windows. Encoding runs while a full match
+ * length of input is ahead of pos. When the buffer is full, the upper window
+ * slides down to become history and the hash chain positions are adjusted.
+ * Each slide costs one pass over the buffer and the hash heads, a constant
+ * per input byte.
+ */
+#include "AbendLz.h"
+#include <string.h>
+
+constexpr uint32_t kLzBackrefBits = 1u + ABENDINFO_LZ_WINDOW_BITS + ABENDINFO_LZ_LENGTH_BITS;
+constexpr uint32_t kLzLiteralBits = 9u;
+constexpr uint32_t kLzFlushSize   = kAbendLzOutSize & ~3u;
+
+static inline uint32_t lzHash(const uint8_t *p) {
+    return (uint32_t)(p[0] * 33u + p[1]) & (kAbendLzHashSize - 1u);
+}
+
+static void lzFlush(AbendLzEncoder *lz, size_t len) {
+    if (lz->ok && len) {
+        lz->ok = lz->emit(lz->ctx, lz->out, len);
+    }
+    lz->out_len -= len;
+    memmove(lz->out, &lz->out[len], lz->out_len);
+}
+
+static void lzPutBits(AbendLzEncoder *lz, uint32_t value, uint32_t count) {
+    lz->bits = (lz->bits << count) | value;
+    lz->nbits += count;
+    while (lz->nbits >= 8) {
+        lz->nbits -= 8;
+        lz->out[lz->out_len++] = (uint8_t)(lz->bits >> lz->nbits);
+        lz->total_out++;
+        if (lz->out_len >= kLzFlushSize) lzFlush(lz, kLzFlushSize);
+    }
+}
+
+static inline void lzInsert(AbendLzEncoder *lz, uint32_t pos) {
+    uint32_t h = lzHash(&lz->buf[pos]);
+    lz->prev[pos] = lz->head[h];
+    lz->head[h] = (int16_t)pos;
+}
+
+void abendLzInit(AbendLzEncoder *lz, AbendLzEmit emit, void *ctx) {
+    memset(lz, 0, sizeof(AbendLzEncoder));
+    for (size_t i = 0; i < kAbendLzHashSize; i++) lz->head[i] = -1;
+    lz->emit = emit;
+    lz->ctx  = ctx;
+    lz->ok   = true;
+}
+
+/*
+  Encode from pos while at least `ahead` bytes of input remain, or to the end
+  of the buffer when ahead is 0.
+*/
+static void lzEncode(AbendLzEncoder *lz, uint32_t ahead) {
+    while (lz->ok && lz->pos < lz->fill && (uint32_t)(lz->fill - lz->pos) >= ahead) {
+        const uint32_t pos = lz->pos;
+        const uint8_t *cur = &lz->buf[pos];
+        uint32_t avail = lz->fill - pos;
+        if (avail > kAbendLzMaxMatch) avail = kAbendLzMaxMatch;
+
+        uint32_t best_len = 0;
+        uint32_t best_dist = 0;
+        if (avail >= kAbendLzMinMatch) {
+            int32_t cand = lz->head[lzHash(cur)];
+            for (uint32_t depth = 0; cand >= 0 && depth < ABENDINFO_LZ_DEPTH; depth++) {
+                uint32_t dist = pos - (uint32_t)cand;
+                if (dist > kAbendLzWindow) break;
+                const uint8_t *ref = &lz->buf[cand];
+                uint32_t len = 0;
+                while (len < avail && ref[len] == cur[len]) len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = dist;
+                    if (len == avail) break;
+                }
+                cand = lz->prev[cand];
+            }
+        }
+
+        if (best_len >= kAbendLzMinMatch) {
+            lzPutBits(lz, 0, 1);
+            lzPutBits(lz, best_dist - 1u, ABENDINFO_LZ_WINDOW_BITS);
+            lzPutBits(lz, best_len - kAbendLzMinMatch, ABENDINFO_LZ_LENGTH_BITS);
+        } else {
+            best_len = 1;
+            lzPutBits(lz, 0x100u | *cur, kLzLiteralBits);
+        }
+        for (uint32_t i = 0; i < best_len; i++) {
+            if (pos + i + 1u < lz->fill) lzInsert(lz, pos + i);
+        }
+        lz->pos += best_len;
+    }
+}
+
+static void lzSlide(AbendLzEncoder *lz) {
+    const int16_t n = (int16_t)kAbendLzWindow;
+    memmove(lz->buf, &lz->buf[n], lz->fill - n);
+    memmove(lz->prev, &lz->prev[n], (lz->fill - n) * sizeof(lz->prev[0]));
+    lz->fill -= n;
+    lz->pos  -= n;
+    for (size_t i = 0; i < lz->fill; i++) {
+        lz->prev[i] = (lz->prev[i] >= n) ? lz->prev[i] - n : -1;
+    }
+    for (size_t i = 0; i < kAbendLzHashSize; i++) {
+        lz->head[i] = (lz->head[i] >= n) ? lz->head[i] - n : -1;
+    }
+}
+
+bool abendLzWrite(AbendLzEncoder *lz, const void *data, size_t len) {
+    const uint8_t *src = (const uint8_t *)data;
+    lz->total_in += len;
+    while (lz->ok && len) {
+        size_t n = sizeof(lz->buf) - lz->fill;
+        if (n > len) n = len;
+        memcpy(&lz->buf[lz->fill], src, n);
+        lz->fill += n;
+        src += n;
+        len -= n;
+        if (lz->fill == sizeof(lz->buf)) {
+            lzEncode(lz, kAbendLzMaxMatch);
+            lzSlide(lz);
+        }
+    }
+    return lz->ok;
+}
+
+bool abendLzFinish(AbendLzEncoder *lz) {
+    lzEncode(lz, 0);
+    if (lz->nbits) lzPutBits(lz, 0, 8 - lz->nbits);
+    lzFlush(lz, lz->out_len);
+    return lz->ok;
+}
+
+struct LzBitReader {
+    const uint8_t *in;
+    size_t   len;       // in bits
+    size_t   pos;       // in bits
+
+    inline uint32_t get(uint32_t count) {
+        uint32_t v = 0;
+        for (; count; count--, pos++) {
+            v = (v << 1) | ((in[pos >> 3] >> (7u - (pos & 7u))) & 1u);
+        }
+        return v;
+    }
+};
+
+size_t abendLzDecode(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    LzBitReader r = { in, in_len * 8u, 0 };
+    size_t n = 0;
+    while (r.len - r.pos >= kLzLiteralBits) {
+        if (r.get(1)) {
+            if (n >= out_len) return SIZE_MAX;
+            out[n++] = (uint8_t)r.get(8);
+            continue;
+        }
+        if (r.len - r.pos < kLzBackrefBits - 1u) break;     // padding
+        size_t dist = r.get(ABENDINFO_LZ_WINDOW_BITS) + 1u;
+        size_t len  = r.get(ABENDINFO_LZ_LENGTH_BITS) + kAbendLzMinMatch;
+        if (dist > n || len > out_len - n) return SIZE_MAX;
+        for (; len; len--, n++) out[n] = out[n - dist];
+    }
+    return n;
+}
@@ -0,0 +1,89 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Streaming LZSS compressor with fixed memory, in the style of heatshrink
+ *
+ * Summary:
+ *   * Output is a bit stream, MSB first. A 1 bit is followed by an 8-bit
+ *     literal. A 0 bit is followed by a back reference: distance - 1 in
+ *     ABENDINFO_LZ_WINDOW_BITS and length - 2 in ABENDINFO_LZ_LENGTH_BITS.
+ *   * The encoder state is a caller supplied struct, no heap. Matches are
+ *     found with hash chains limited to ABENDINFO_LZ_DEPTH probes, the time
+ *     per input byte is bounded.
+ *   * Output is passed to a caller supplied function in small blocks. All
+ *     blocks but the last are a multiple of 4 bytes, suitable for flash.
+ *   * There is no end marker. The decoder is given the exact compressed
+ *     length, fewer than 9 bits left over are padding.
+ *
+ * Stack and heap images are mostly zeros and repeated pointers. Runs of a
+ * repeated byte or word are back references to a distance of 1 or 4.
+ *
+ * No Arduino dependencies; used on the device and on a Linux host, see
+ * tools/abendlz.cpp.
+ */
+#ifndef ABENDLZ_H_
+#define ABENDLZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef ABENDINFO_LZ_WINDOW_BITS
+#define ABENDINFO_LZ_WINDOW_BITS 8
+#endif
+#ifndef ABENDINFO_LZ_LENGTH_BITS
+#define ABENDINFO_LZ_LENGTH_BITS 6
+#endif
+#ifndef ABENDINFO_LZ_DEPTH
+#define ABENDINFO_LZ_DEPTH 8
+#endif
+
+constexpr size_t kAbendLzWindow   = 1u << ABENDINFO_LZ_WINDOW_BITS;
+constexpr size_t kAbendLzMinMatch = 2u;
+constexpr size_t kAbendLzMaxMatch = kAbendLzMinMatch + (1u << ABENDINFO_LZ_LENGTH_BITS) - 1u;
+constexpr size_t kAbendLzHashSize = 256u;
+constexpr size_t kAbendLzOutSize  = 64u;
+static_assert(kAbendLzMaxMatch <= kAbendLzWindow && ABENDINFO_LZ_WINDOW_BITS <= 14);
+
+// Returns false to stop the encoder
+typedef bool (*AbendLzEmit)(void *ctx, const uint8_t *buf, size_t len);
+
+struct AbendLzEncoder {
+    uint8_t  buf[2 * kAbendLzWindow];   // history, then input not yet encoded
+    int16_t  head[kAbendLzHashSize];    // latest position for a hash, -1 none
+    int16_t  prev[2 * kAbendLzWindow];  // previous position with the same hash
+    uint16_t fill;      // bytes in buf
+    uint16_t pos;       // next byte of buf to encode
+    uint32_t bits;      // bit accumulator
+    uint32_t nbits;
+    uint8_t  out[kAbendLzOutSize];
+    uint32_t out_len;
+    uint32_t total_in;
+    uint32_t total_out;
+    AbendLzEmit emit;
+    void    *ctx;
+    bool     ok;
+};
+
+void abendLzInit(AbendLzEncoder *lz, AbendLzEmit emit, void *ctx);
+bool abendLzWrite(AbendLzEncoder *lz, const void *data, size_t len);
+// Encode what is left and flush. total_out is then the compressed length.
+bool abendLzFinish(AbendLzEncoder *lz);
+
+// Returns the number of bytes written to out, or SIZE_MAX when in is
+// malformed or out is too small.
+size_t abendLzDecode(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+#endif // ABENDLZ_H_
@@ -507,6 +507,7 @@ err_t abendCheckNetwork(void) {
         // ?) Is the scheduled timer callback running ?
         // ?)
         netmon.restart = true;
+        abendSetRestartCause(ABEND_RESET_NETWORK);
         // Confirmed, with 20 minutes of AP availableBytes w/o a Station Network
         // connection will return false.
         if (ERR_OK == netmon.err) netmon.err = ERR_TIMEOUT; // or keep previous error
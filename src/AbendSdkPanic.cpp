@@ -0,0 +1,479 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Recognize SDK panics from their last gasp text
+ *
+ * The ets_printf before an SDK panic's deliberate infinite loop prints an
+ * abbreviated module name followed by a line number, e.g. "pm 1160". Unlike
+ * epc1, this survives a rebuild of the Sketch. The text is parsed into a
+ * module and a line. The module is looked up, with a binary search, in a
+ * sorted table held in flash that names the SDK part that failed. Only the
+ * module is named, the line is reported as is.
+ *
+ * With ABENDINFO_SDK_PANIC_INDEX, the panic sites themselves are found once
+ * at boot. IRAM and flash code is scanned for a call to ets_printf followed
+ * by `j .`, and the return addresses are kept in a sorted table with a bitmap
+ * in front. The ets_printf wrapper then no longer reads code at its return
+ * address on every call.
+ */
+#include "Arduino.h"
+#include <ets_sys.h> // ets_printf, ets_get_cpu_frequency
+#include "AbendInfo.h"
+
+#if ABENDINFO_OPTION && ABENDINFO_IDENTIFY_SDK_PANIC
+
+#pragma GCC optimize("Os")
+
+struct SdkPanicModule {
+    PGM_P    module;
+    PGM_P    desc;
+};
+
+#define SDK_STR(name, str) static const char name[] PROGMEM = str
+
+SDK_STR(mod_esf_buf,      "esf_buf");
+SDK_STR(mod_if_hwctrl,    "if_hwctrl");
+SDK_STR(mod_lmac,         "lmac");
+SDK_STR(mod_pm,           "pm");
+SDK_STR(mod_pp,           "pp");
+SDK_STR(mod_rate_control, "rate_control");
+SDK_STR(mod_wdev,         "wdev");
+SDK_STR(mod_wl_chm,       "wl_chm");
+SDK_STR(mod_wl_cnx,       "wl_cnx");
+
+SDK_STR(desc_esf_buf,      "WiFi RX/TX buffer pool (libpp)");
+SDK_STR(desc_if_hwctrl,    "WiFi interface hardware control (libpp)");
+SDK_STR(desc_lmac,         "WiFi lower MAC, TX queue (libpp)");
+SDK_STR(desc_pm,           "Power management, modem/light sleep (libpp)");
+SDK_STR(desc_pp,           "WiFi packet processing task (libpp)");
+SDK_STR(desc_rate_control, "WiFi TX rate control (libpp)");
+SDK_STR(desc_wdev,         "WiFi device interrupt handling (libpp)");
+SDK_STR(desc_wl_chm,       "WiFi channel manager (libnet80211)");
+SDK_STR(desc_wl_cnx,       "WiFi connection manager (libnet80211)");
+
+/*
+  SDK v3.0.5 modules with panics. Keep sorted by module.
+*/
+static const SdkPanicModule sdkPanicModules[] PROGMEM = {
+    { mod_esf_buf,      desc_esf_buf },
+    { mod_if_hwctrl,    desc_if_hwctrl },
+    { mod_lmac,         desc_lmac },
+    { mod_pm,           desc_pm },
+    { mod_pp,           desc_pp },
+    { mod_rate_control, desc_rate_control },
+    { mod_wdev,         desc_wdev },
+    { mod_wl_chm,       desc_wl_chm },
+    { mod_wl_cnx,       desc_wl_cnx },
+};
+constexpr size_t kSdkPanicModuleCount = sizeof(sdkPanicModules) / sizeof(sdkPanicModules[0]);
+
+static inline bool isBlank(char c) {
+    return ' ' == c || '\t' == c || '\r' == c || '\n' == c;
+}
+
+/*
+  Parse last gasp text of the form "module line". A trailing ".c" on the
+  module name is dropped. Returns false when the text does not match.
+*/
+bool abendParseGasp(const char *gasp, char *module, size_t size, uint32_t *line) {
+    if (NULL == gasp || 0 == size) return false;
+    while (isBlank(*gasp)) gasp++;
+
+    size_t len = 0;
+    while (gasp[len] && !isBlank(gasp[len])) len++;
+    if (len > 2 && '.' == gasp[len - 2] && 'c' == gasp[len - 1]) {
+        if (0 == len - 2 || len - 2 >= size) return false;
+        memcpy(module, gasp, len - 2);
+        module[len - 2] = '\0';
+    } else {
+        if (0 == len || len >= size) return false;
+        memcpy(module, gasp, len);
+        module[len] = '\0';
+    }
+    gasp += len;
+
+    if (! isBlank(*gasp)) return false;
+    while (isBlank(*gasp)) gasp++;
+    if (*gasp < '0' || *gasp > '9') return false;
+    uint32_t value = 0;
+    for (; *gasp >= '0' && *gasp <= '9'; gasp++) {
+        value = value * 10u + (uint32_t)(*gasp - '0');
+    }
+    while (isBlank(*gasp)) gasp++;
+    if (*gasp) return false;
+    *line = value;
+    return true;
+}
+
+static int compareModule(const SdkPanicModule *entry, const char *module) {
+    return -strcmp_P(module, (PGM_P)pgm_read_ptr(&entry->module));
+}
+
+static const SdkPanicModule *findModule(const char *module) {
+    size_t lo = 0;
+    size_t hi = kSdkPanicModuleCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compareModule(&sdkPanicModules[mid], module);
+        if (0 == cmp) return &sdkPanicModules[mid];
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/*
+  Returns the name in flash of the part of the SDK a panic module belongs to,
+  or NULL when unknown.
+*/
+PGM_P abendSdkPanicModule(const char *module) {
+    const SdkPanicModule *entry = findModule(module);
+    return (entry) ? (PGM_P)pgm_read_ptr(&entry->desc) : NULL;
+}
+
+#if ABENDINFO_DEFERRED_GASP || ABENDINFO_PRINTF_HISTOGRAM
+extern "C" {
+extern char _data_start[], _bss_end[];
+}
+
+/*
+  Format strings are in the Boot ROM, flash, or static DRAM, and stay where
+  they are for the life of a build. Strings on the heap or stack do not.
+*/
+static bool isGaspReadable(uint32_t addr) {
+    return (addr >= 0x40000000u && addr < 0x40010000u) ||     // Boot ROM
+           (addr >= 0x40200000u && addr < 0x40300000u) ||     // Flash
+           (addr >= (uint32_t)_data_start && addr < (uint32_t)_bss_end);
+}
+
+// Code memory needs 32-bit loads, pgm_read_byte works for all three.
+static char gaspByte(uint32_t addr) {
+    return (isGaspReadable(addr)) ? (char)pgm_read_byte((const void *)addr) : '\0';
+}
+#endif
+
+#if ABENDINFO_DEFERRED_GASP
+/*
+  The ets_printf wrapper recorded the format and argument registers of the
+  panic message. This build is the one that crashed, format strings are where
+  they were. String arguments that are not readable are shown as their
+  address.
+*/
+size_t abendGaspFormat(const AbendInfo& info, char *buf, size_t size) {
+    if (0 == size || 0 == gaspByte(info.fmt)) return 0;
+    uint32_t fmt = info.fmt;
+    size_t n = 0;
+    size_t arg = 0;
+    while (n + 1 < size) {
+        char c = gaspByte(fmt++);
+        if ('\0' == c) break;
+        if ('%' != c) {
+            buf[n++] = c;
+            continue;
+        }
+        // Conversion spec: flags, width, precision, and length, then the type
+        char spec[12];
+        size_t k = 0;
+        spec[k++] = '%';
+        do {
+            c = gaspByte(fmt++);
+            if (k < sizeof(spec) - 1) spec[k++] = c;
+        } while (c && strchr("-+ #.0123456789hlz", c));
+        spec[k] = '\0';
+        if ('\0' == c) break;
+        if ('%' == c) {
+            buf[n++] = '%';
+            continue;
+        }
+        int len;
+        if (arg >= ABENDINFO_GASP_ARGS || strstr(spec, "ll")) {
+            // Stack passed or 64-bit arguments were not recorded
+            len = snprintf(&buf[n], size - n, "%s", spec);
+            arg = ABENDINFO_GASP_ARGS;
+        } else if ('s' == c) {
+            const uint32_t addr = info.args[arg++];
+            char str[64];
+            size_t i = 0;
+            for (; i < sizeof(str) - 1 && (str[i] = gaspByte(addr + i)); i++) {}
+            str[i] = '\0';
+            if (0 == i && ! isGaspReadable(addr)) {
+                len = snprintf(&buf[n], size - n, "<0x%08x>", addr);
+            } else {
+                len = snprintf(&buf[n], size - n, spec, str);
+            }
+        } else if ('p' == c) {
+            len = snprintf(&buf[n], size - n, "0x%08x", info.args[arg++]);
+        } else if (strchr("diouxXc", c)) {
+            len = snprintf(&buf[n], size - n, spec, info.args[arg++]);
+        } else {
+            len = snprintf(&buf[n], size - n, "%s", spec);
+        }
+        if (len < 0) break;
+        n += ((size_t)len < size - n) ? (size_t)len : size - n - 1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+#endif // ABENDINFO_DEFERRED_GASP
+
+#if ABENDINFO_PRINTF_HISTOGRAM
+AbendPrintfStats abendPrintfStats;
+
+/*
+  Called by the ets_printf wrapper after each call with the caller's return
+  address. Linear probing, at most 8 entries are looked at.
+*/
+extern "C" IRAM_ATTR void abendPrintfCount(uint32_t pc, uint32_t chars_at_entry) {
+    AbendPrintfStats& st = abendPrintfStats;
+    uint32_t save_ps = xt_rsil(15);
+    const uint32_t bytes = st.chars - chars_at_entry;
+    uint32_t h = ((pc >> 2) * 2654435761u) >> 16;
+    for (size_t probe = 0; probe < 8; probe++, h++) {
+        AbendPrintfSite& e = st.site[h % ABENDINFO_PRINTF_HISTOGRAM];
+        if (0 == e.pc) {
+            e.pc  = pc;
+            e.fmt = st.fmt;
+        }
+        if (pc == e.pc) {
+            e.calls++;
+            e.bytes    += bytes;
+            st.counted += bytes;
+            xt_wsr_ps(save_ps);
+            return;
+        }
+    }
+    st.missed++;
+    xt_wsr_ps(save_ps);
+}
+
+// First word of the format, the SDK module name by its own convention
+static size_t printfModule(uint32_t fmt, char *name, size_t size) {
+    size_t n = 0;
+    for (char c = gaspByte(fmt); n + 1 < size && c && !strchr(" :%\r\n", c); c = gaspByte(++fmt)) {
+        name[n++] = c;
+    }
+    name[n] = '\0';
+    return n;
+}
+
+struct PrintfModule {
+    char     name[12];
+    uint32_t calls;
+    uint32_t bytes;
+};
+
+void abendInfoPrintfReport(Print& sio, size_t count) {
+    const AbendPrintfStats& st = abendPrintfStats;
+    sio.printf_P(PSTR("\r\nets_printf Output by Caller: (%u characters, %u not through ets_printf)\r\n"),
+        st.chars, st.chars - st.counted);
+    if (st.missed) {
+        sio.printf_P(PSTR("  %u calls not counted, raise ABENDINFO_PRINTF_HISTOGRAM\r\n"), st.missed);
+    }
+    // Repeated selection of the largest, the table is small and a hash.
+    bool shown[ABENDINFO_PRINTF_HISTOGRAM] = {};
+    for (size_t n = 0; n < count; n++) {
+        const AbendPrintfSite *top = NULL;
+        size_t top_i = 0;
+        for (size_t i = 0; i < ABENDINFO_PRINTF_HISTOGRAM; i++) {
+            const AbendPrintfSite& e = st.site[i];
+            if (e.pc && !shown[i] && (NULL == top || e.bytes > top->bytes)) {
+                top = &e;
+                top_i = i;
+            }
+        }
+        if (NULL == top) break;
+        shown[top_i] = true;
+        char text[25];
+        size_t i = 0;
+        for (char c = gaspByte(top->fmt); i + 1 < sizeof(text) && c; c = gaspByte(top->fmt + ++i)) {
+            text[i] = (' ' <= c && '~' >= c) ? c : '.';
+        }
+        text[i] = '\0';
+        sio.printf_P(PSTR("  @0x%08x %7u calls %8u bytes  '%s'\r\n"), top->pc, top->calls, top->bytes, text);
+    }
+
+    PrintfModule mod[16];
+    size_t mods = 0;
+    for (size_t i = 0; i < ABENDINFO_PRINTF_HISTOGRAM; i++) {
+        const AbendPrintfSite& e = st.site[i];
+        if (0 == e.pc) continue;
+        char name[sizeof(mod[0].name)];
+        if (0 == printfModule(e.fmt, name, sizeof(name))) { name[0] = '?'; name[1] = '\0'; }
+        size_t m = 0;
+        while (m < mods && strcmp(mod[m].name, name)) m++;
+        if (m == mods) {
+            if (mods == sizeof(mod) / sizeof(mod[0])) continue;
+            memcpy(mod[m].name, name, sizeof(name));
+            mod[m].calls = mod[m].bytes = 0;
+            mods++;
+        }
+        mod[m].calls += e.calls;
+        mod[m].bytes += e.bytes;
+    }
+    if (0 == mods) return;
+    // Insertion sort by bytes, largest first
+    for (size_t i = 1; i < mods; i++) {
+        PrintfModule v = mod[i];
+        size_t j = i;
+        for (; j && mod[j - 1].bytes < v.bytes; j--) mod[j] = mod[j - 1];
+        mod[j] = v;
+    }
+    sio.printf_P(PSTR("  Top modules, by the first word of the format:\r\n"));
+    for (size_t m = 0; m < mods && m < count; m++) {
+        sio.printf_P(PSTR("    %-12s %7u calls %8u bytes\r\n"), mod[m].name, mod[m].calls, mod[m].bytes);
+    }
+}
+#endif // ABENDINFO_PRINTF_HISTOGRAM
+
+#if ABENDINFO_SDK_PANIC_INDEX
+extern "C" {
+extern char _text_start[], _text_end[];
+extern char _irom0_text_start[], _irom0_text_end[];
+}
+
+AbendSdkPanicIndex abendSdkPanicIndex;
+
+static inline void memoryBarrier(void) {
+    asm volatile("memw" ::: "memory");
+}
+
+/*
+  call is the 3 byte instruction ending at ret. Accept `callx0 as`, which in
+  SDK flash code calls ets_printf through a literal, and `call0 ets_printf`.
+  A callx0 to another function is harmless; only ets_printf looks up its
+  return address.
+*/
+static bool isPrintfCall(uint32_t call, uint32_t ret) {
+    if (0x0000c0u == (call & 0xfff0ffu)) return true;
+    if (0x05u == (call & 0x3fu)) {
+        int32_t offset = (int32_t)(call << 8) >> 14;
+        return ((ret - 3u) & ~3u) + ((uint32_t)offset << 2) + 4u == (uint32_t)&ets_printf;
+    }
+    return false;
+}
+
+static inline bool hasByte06(uint32_t w) {
+    w ^= 0x06060606u;
+    return 0 != ((w - 0x01010101u) & ~w & 0x80808080u);
+}
+
+/*
+  Code memory only allows 32-bit loads. Walk aligned words with one word of
+  look behind for the call and one of look ahead for the `j .`, 0x06 0xff 0xff.
+*/
+static uint32_t scanPanicSites(uint32_t start, uint32_t end, uint32_t n) {
+    const uint32_t *p    = (const uint32_t *)(start & ~3u);
+    const uint32_t *last = (const uint32_t *)((end + 3u) & ~3u) - 1;
+    if (p >= last) return n;
+    uint32_t prev = 0;
+    uint32_t cur  = p[0];
+    for (; p < last; p++) {
+        const uint32_t next = p[1];
+        if (hasByte06(cur)) {
+            const uint64_t behind = ((uint64_t)cur << 32) | prev;
+            const uint64_t ahead  = ((uint64_t)next << 32) | cur;
+            for (uint32_t k = 0; k < 4; k++) {
+                if (0x00ffff06u != ((uint32_t)(ahead >> (8 * k)) & 0x00ffffffu)) continue;
+                const uint32_t ret  = (uint32_t)p + k;
+                const uint32_t call = (uint32_t)(behind >> (8 * (k + 1))) & 0x00ffffffu;
+                if (! isPrintfCall(call, ret)) continue;
+                if (n < ABENDINFO_SDK_PANIC_INDEX) abendSdkPanicIndex.site[n] = ret;
+                n++;
+            }
+        }
+        prev = cur;
+        cur  = next;
+    }
+    return n;
+}
+
+/*
+  The wrapper inspects code while count is 0. IRAM is below flash, so sites
+  are found in sorted order. count is set last, once the table and bitmap
+  are complete.
+*/
+void abendSdkPanicIndexBuild(void) {
+    AbendSdkPanicIndex& idx = abendSdkPanicIndex;
+    const uint32_t start = esp_get_cycle_count();
+    idx.count = 0;
+    memoryBarrier();
+    uint32_t n = scanPanicSites((uint32_t)_text_start, (uint32_t)_text_end, 0);
+    n = scanPanicSites((uint32_t)_irom0_text_start, (uint32_t)_irom0_text_end, n);
+    idx.found = n;
+    if (n <= ABENDINFO_SDK_PANIC_INDEX) {
+        memset(idx.bitmap, 0, sizeof(idx.bitmap));
+        for (size_t i = 0; i < n; i++) {
+            idx.bitmap[(idx.site[i] >> 3) & 0xffu] |= 1u << (idx.site[i] & 7u);
+        }
+        memoryBarrier();
+        idx.count = n;
+    }
+    idx.cycles = esp_get_cycle_count() - start;
+}
+
+// Called from the ets_printf wrapper when the bitmap bit is set.
+extern "C" IRAM_ATTR bool abendSdkPanicSiteFind(uint32_t ret) {
+    const uint32_t *site = abendSdkPanicIndex.site;
+    size_t lo = 0;
+    size_t hi = abendSdkPanicIndex.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (site[mid] == ret) return true;
+        if (site[mid] < ret) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+// Fastest of several ets_printf("") calls, the least disturbed by interrupts.
+static uint32_t etsPrintfCycles(void) {
+    uint32_t best = UINT32_MAX;
+    for (size_t i = 0; i < 16; i++) {
+        uint32_t t = esp_get_cycle_count();
+        ets_printf("");
+        t = esp_get_cycle_count() - t;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+void abendInfoSdkPanicIndexReport(Print& sio) {
+    AbendSdkPanicIndex& idx = abendSdkPanicIndex;
+    sio.printf_P(PSTR("\r\nSDK Panic Site Index:\r\n"));
+    sio.printf_P(PSTR("  %-23S %u found, capacity %u\r\n"), PSTR("Sites:"), idx.found, ABENDINFO_SDK_PANIC_INDEX);
+    sio.printf_P(PSTR("  %-23S %u us\r\n"), PSTR("Boot scan:"), idx.cycles / ets_get_cpu_frequency());
+    if (0 == idx.count) {
+        sio.printf_P(PSTR("  Not in use, %S\r\n"), (idx.found) ? PSTR("raise ABENDINFO_SDK_PANIC_INDEX") : PSTR("no sites found"));
+        return;
+    }
+    // A count of 0 sends the wrapper back to inspecting code, measure both.
+    const uint32_t indexed = etsPrintfCycles();
+    const uint32_t count = idx.count;
+    idx.count = 0;
+    memoryBarrier();
+    const uint32_t inspected = etsPrintfCycles();
+    idx.count = count;
+    sio.printf_P(PSTR("  %-23S %u cycles indexed, %u cycles inspecting code\r\n"), PSTR("ets_printf(\"\"):"), indexed, inspected);
+}
+#endif // ABENDINFO_SDK_PANIC_INDEX
+
+#endif // ABENDINFO_OPTION && ABENDINFO_IDENTIFY_SDK_PANIC
@@ -0,0 +1,83 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Word run-length encoding of a crash stack window, see AbendStackWindow.h
+ *
+ * One pass over the window. A word is read at most kAbendStackRleMinRun
+ * times, the time taken is bounded by the window size.
+ */
+#include "AbendStackWindow.h"
+
+static inline uint32_t stackWord(const uint32_t *in, size_t i, AbendStackKeep keep) {
+    const uint32_t value = in[i];
+    return (NULL == keep || keep(value)) ? value : 0u;
+}
+
+size_t abendStackRleEncode(const uint32_t *in, size_t n, AbendStackKeep keep,
+    uint32_t *out, size_t out_max, size_t *used) {
+    size_t i = 0, o = 0;
+    while (i < n && o + 1u < out_max) {
+        const size_t control = o++;
+        uint32_t literals = 0, run = 0;
+        while (i < n) {
+            const uint32_t value = stackWord(in, i, keep);
+            size_t len = 1u;
+            while (i + len < n && len < kAbendStackRleMaxCount && stackWord(in, i + len, keep) == value) {
+                len++;
+            }
+            if (len >= kAbendStackRleMinRun) {
+                if (o < out_max) {
+                    out[o++] = value;
+                    run = len;
+                    i  += len;
+                }
+                break;
+            }
+            if (o >= out_max || kAbendStackRleMaxCount == literals) break;
+            out[o++] = value;
+            literals++;
+            i++;
+        }
+        if (0 == literals && 0 == run) {
+            o = control;
+            break;
+        }
+        out[control] = (run << 16) | literals;
+    }
+    if (used) *used = i;
+    return o;
+}
+
+size_t abendStackRleDecode(const uint32_t *in, size_t n, uint32_t *out, size_t out_max) {
+    size_t i = 0, o = 0;
+    while (i < n) {
+        const uint32_t literals = in[i] & 0xffffu;
+        const uint32_t run      = in[i] >> 16;
+        i++;
+        if (n - i < literals + ((run) ? 1u : 0u)) break;
+        for (uint32_t k = 0; k < literals && o < out_max; k++) {
+            out[o++] = in[i + k];
+        }
+        i += literals;
+        if (run) {
+            for (uint32_t k = 0; k < run && o < out_max; k++) {
+                out[o++] = in[i];
+            }
+            i++;
+        }
+    }
+    return o;
+}
@@ -0,0 +1,60 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Word run-length encoding of a crash stack window
+ *
+ * Summary:
+ *   * The window is the stack words from the stack pointer up. With a keep
+ *     function, eg. one accepting code addresses, the words it rejects are
+ *     encoded as 0. The stack offsets of the words kept do not change.
+ *   * The encoding is a sequence of groups. A group is a control word, the
+ *     literal words, then the run word when there is a run. The control word
+ *     holds the run length in bits 31..16 and the number of literals in bits
+ *     15..0. The run word stands for run length copies of itself.
+ *   * kAbendStackRleMinRun or more equal words make a run. The encoding is at
+ *     most one word longer than the window.
+ *   * The encoder stops at the end of the output and reports the window
+ *     words it covered. A group is never split, the output decodes as is.
+ *
+ * No Arduino dependencies; used on the device and on a Linux host, see
+ * tools/abendstack.cpp.
+ */
+#ifndef ABENDSTACKWINDOW_H_
+#define ABENDSTACKWINDOW_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+constexpr size_t kAbendStackRleMinRun = 3u;
+constexpr size_t kAbendStackRleMaxCount = 0xffffu;  // literals or run length in a group
+
+// Returns false for a word to be encoded as 0
+typedef bool (*AbendStackKeep)(uint32_t value);
+
+/*
+  Encodes the n words at in to out, at most out_max words, and returns the
+  number written. *used is set to the words of in covered. keep may be NULL.
+*/
+size_t abendStackRleEncode(const uint32_t *in, size_t n, AbendStackKeep keep,
+    uint32_t *out, size_t out_max, size_t *used);
+
+/*
+  Decodes the n words at in to out, at most out_max words, and returns the
+  number decoded. A group cut short by the end of in is dropped.
+*/
+size_t abendStackRleDecode(const uint32_t *in, size_t n, uint32_t *out, size_t out_max);
+
+#endif // ABENDSTACKWINDOW_H_
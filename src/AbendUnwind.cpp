@@ -0,0 +1,131 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * call0 stack unwinder for the crash callback
+ *
+ * Walks the stack with the frame sizes in the flash table filled in by
+ * tools/abendunwind.cpp, see AbendUnwind.h. Each frame is a binary search of
+ * the table and one load from the stack, no prologue scanning, so the time
+ * taken is bounded by the depth. Unwinding stops at a PC not in the table, at
+ * a function that can not be unwound, or when a return address or the stack
+ * pointer does not look right.
+ *
+ * Until the tool has been run on the ELF the table is empty and no backtrace
+ * is saved.
+ */
+#include "Arduino.h"
+#include "AbendInfo.h"
+
+#if ABENDINFO_OPTION && ABENDINFO_UNWIND_TABLE
+#include "AbendUnwind.h"
+
+#pragma GCC optimize("Os")
+
+struct AbendUnwindImage {
+    AbendUnwindHeader hdr;
+    AbendUnwindEntry  entry[ABENDINFO_UNWIND_TABLE];
+};
+
+extern "C" {
+// Found by symbol name in the ELF, keep it unmangled
+extern const AbendUnwindImage abendUnwindTable;
+const AbendUnwindImage abendUnwindTable PROGMEM __attribute__((aligned(4))) = {
+    { ABENDUNWIND_MAGIC, ABENDINFO_UNWIND_TABLE, 0, 0 }, {}
+};
+}
+
+// The table is patched after linking, hide its contents from the optimizer.
+static inline const AbendUnwindImage *unwindTable(void) {
+    const AbendUnwindImage *t = &abendUnwindTable;
+    asm("" : "+r"(t));
+    return t;
+}
+
+static inline bool isCodeAddress(uint32_t pc) {
+    return pc >= XCHAL_INSTRAM0_VADDR && pc < (XCHAL_INSTROM0_VADDR + XCHAL_INSTROM0_SIZE);
+}
+
+// Flash is read a word at a time. Returns false for a PC before the first
+// function.
+static bool unwindFind(const AbendUnwindImage *t, uint32_t pc, AbendUnwindEntry *e) {
+    size_t lo = 0, hi = t->hdr.count;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2u;
+        if (t->entry[mid].start <= pc) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    if (0 == lo) return false;
+    const uint32_t *w = (const uint32_t *)&t->entry[lo - 1u];
+    e->start = w[0];
+    e->frame = w[1] & 0xffffu;
+    e->ra    = (w[1] >> 16) & 0xffu;
+    e->setup = w[1] >> 24;
+    return true;
+}
+
+size_t abendUnwind(uint32_t pc, uint32_t a0, uint32_t sp, uint32_t stack_end, uint32_t *ret, size_t max) {
+    const AbendUnwindImage *t = unwindTable();
+    if (ABENDUNWIND_MAGIC != t->hdr.magic || 0 == t->hdr.count || t->hdr.count > ABENDINFO_UNWIND_TABLE) {
+        return 0;
+    }
+    size_t n = 0;
+    bool top = (0 != pc);
+    if (! top) {
+        // A call to an invalid address, a0 is the return address
+        if (! isCodeAddress(a0)) return 0;
+        ret[n++] = pc = a0;
+    }
+    while (n < max) {
+        AbendUnwindEntry e;
+        // A return address may be just past the end of a noreturn call's
+        // function, look up the call.
+        const bool found = unwindFind(t, (top) ? pc : pc - 1u, &e);
+        if (found && kAbendUnwindUnknown == e.frame) break;
+        uint32_t ra;
+        if (top && (!found || pc - e.start < e.setup || kAbendUnwindLeaf == e.ra)) {
+            // Not in the table, eg. the Boot ROM, or a0 not saved (yet)
+            ra = a0;
+            if (found && pc - e.start >= e.setup) sp += e.frame;
+        } else if (!found || kAbendUnwindLeaf == e.ra) {
+            // Only the top frame can be a leaf
+            break;
+        } else {
+            if (sp + 4u * e.ra + 4u > stack_end) break;
+            ra = ((const uint32_t *)sp)[e.ra];
+            sp += e.frame;
+        }
+        if (! isCodeAddress(ra) || sp > stack_end || (sp & 3u)) break;
+        ret[n++] = pc = ra;
+        top = false;
+    }
+    return n;
+}
+
+void abendInfoUnwindReport(Print& sio) {
+    const AbendUnwindImage *t = unwindTable();
+    if (0 == t->hdr.count) {
+        if (t->hdr.functions) {
+            sio.printf_P(PSTR("  Unwind table too small, build with ABENDINFO_UNWIND_TABLE=%u or more\r\n"), t->hdr.functions);
+        } else {
+            sio.printf_P(PSTR("  Unwind table empty, run tools/abendunwind on the ELF\r\n"));
+        }
+    }
+}
+
+#endif // ABENDINFO_OPTION && ABENDINFO_UNWIND_TABLE
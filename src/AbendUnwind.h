@@ -0,0 +1,58 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Layout of the call0 unwind table held in flash
+ *
+ * Summary:
+ *   * The build reserves the table, a header and `capacity` zeroed entries,
+ *     in flash. tools/abendunwind.cpp fills it after linking, in the ELF and
+ *     optionally in the .bin, from the prologues of the functions in the ELF.
+ *   * Entries are sorted by start address. The entry for a PC is the last one
+ *     starting at or below it, found with a binary search.
+ *   * A function's prologue moves a1 down by `frame` bytes and, unless it is
+ *     a leaf, saves a0 at word `ra` of the new frame. An entry with a frame of
+ *     kAbendUnwindUnknown covers code that can not be unwound, eg. a function
+ *     using a frame pointer, or a gap between functions.
+ *
+ * No Arduino dependencies; used on the device and on a Linux host.
+ */
+#ifndef ABENDUNWIND_H_
+#define ABENDUNWIND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ABENDUNWIND_MAGIC 0x444e5755u   // "UWND"
+
+constexpr uint16_t kAbendUnwindUnknown = 0xffffu;   // frame, stop unwinding
+constexpr uint8_t  kAbendUnwindLeaf    = 0xffu;     // ra, a0 is not saved
+
+struct AbendUnwindEntry {
+    uint32_t start;     // function address
+    uint16_t frame;     // bytes a1 is moved down by the prologue
+    uint8_t  ra;        // word of the frame a0 is saved in
+    uint8_t  setup;     // bytes from start to the end of the prologue
+};
+static_assert(sizeof(AbendUnwindEntry) == 8, "two words per entry");
+
+struct AbendUnwindHeader {
+    uint32_t magic;     // ABENDUNWIND_MAGIC
+    uint32_t capacity;  // entries reserved by the build
+    uint32_t count;     // entries filled by abendunwind, 0 until then
+    uint32_t functions; // functions in the ELF, more than count when the table is too small
+};
+
+#endif // ABENDUNWIND_H_
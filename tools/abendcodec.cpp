@@ -0,0 +1,189 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool for the AbendInfo compact record encoding
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendcodec abendcodec.cpp ../src/AbendCodec.cpp
+ *
+ * Usage:
+ *   abendcodec decode <hex>        Decode concatenated records, e.g. RTC memory
+ *   abendcodec bench [iterations]  Size and speed against the raw AbendInfo
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "AbendCodec.h"
+
+/*
+  Layout of struct AbendInfo as built for the device with
+  ABENDINFO_HEAP_MONITOR and the default 64 byte ABENDINFO_GASP_SIZE.
+  time_t is 64 bits in the ESP8266 toolchain.
+*/
+struct RawAbendInfo {
+    uint32_t magic;
+    uint16_t schema;
+    uint16_t size;
+    uint8_t  flags;
+    uint8_t  gasp_size;
+    uint16_t reserved[3];
+    int64_t  uptime;
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t oom;
+    uint32_t heap;
+    uint32_t heap_min;
+    uint32_t low_count;
+    uint32_t last;
+    uint32_t epc1;
+    uint32_t intlevel;
+    uint32_t idx;
+    char     gasp[64];
+    uint32_t crc;
+};
+
+// Same algorithm as the Arduino ESP8266 Core's crc32()
+static uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff) {
+    const uint8_t *ldata = (const uint8_t *)data;
+    while (length--) {
+        uint8_t c = *ldata++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1) {
+            bool bit = crc & 0x80000000u;
+            if (c & i) bit = !bit;
+            crc <<= 1;
+            if (bit) crc ^= 0x04c11db7u;
+        }
+    }
+    return crc;
+}
+
+static void printRecord(const AbendCodecRecord& rec) {
+    printf("  #%-5u reason %3u  EXCCAUSE %2u @0x%08x  uptime %u sec",
+        rec.seq, rec.reason, rec.exccause, rec.epc1, rec.uptime);
+    if (rec.oom) printf(", OOM %u", rec.oom);
+    if (rec.gasp[0]) printf(", '%s'", rec.gasp);
+    printf("\n");
+}
+
+static int decode(const char *hex) {
+    std::vector<uint8_t> buf;
+    for (; hex[0] && hex[1]; hex += 2) {
+        char byte[3] = { hex[0], hex[1], '\0' };
+        buf.push_back((uint8_t)strtoul(byte, NULL, 16));
+    }
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        if (0 == buf[pos] || 0xff == buf[pos]) break;   // unused space
+        AbendCodecRecord rec;
+        size_t n = abendCodecDecode(&buf[pos], buf.size() - pos, &rec);
+        if (0 == n) {
+            printf("  Malformed record at offset %zu\n", pos);
+            return 1;
+        }
+        printRecord(rec);
+        pos += n;
+    }
+    return 0;
+}
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench(unsigned iterations) {
+    static const AbendCodecRecord samples[] = {
+        // seq uptime     reason  exccause  epc1   oom  gasp
+        {  1,  3725,      2,      28,  0x40201e6cu,  0, "" },            // Exception, null pointer
+        {  2,  86412,     101,    0,   0x4010072au,  0, "pm 1160" },     // SDK panic
+        {  3,  12,        2,      6,   0x40203f10u,  0, "" },            // divide by zero
+        {  4,  604800,    3,      4,   0x40000f68u,  0, "" },            // Soft WDT in Boot ROM
+        {  5,  1209600,   254,    0,   0,            7, "" },            // panic(), heap OOM
+        {  6,  45,        2,      20,  0x3fffeb20u,  0, "" },            // Exception 20, bad pointer
+    };
+    constexpr size_t count = sizeof(samples) / sizeof(samples[0]);
+
+    size_t total = 0;
+    printf("Encoded size per record, raw AbendInfo is %zu bytes:\n", sizeof(RawAbendInfo));
+    for (size_t i = 0; i < count; i++) {
+        uint8_t buf[kAbendCodecMaxSize];
+        size_t n = abendCodecEncode(&samples[i], buf, sizeof(buf));
+        total += n;
+        printf("  %3zu bytes ", n);
+        printRecord(samples[i]);
+    }
+    printf("Average %.1f bytes, %zu records per 512 bytes of RTC user memory (raw: %zu)\n",
+        (double)total / count, 512 * count / total, 512 / sizeof(RawAbendInfo));
+
+    // Raw: copy the struct and CRC it, the same as the crash callback does
+    volatile uint32_t sink = 0;
+    RawAbendInfo raw;
+    memset(&raw, 0, sizeof(raw));
+    double t0 = nowNs();
+    for (unsigned it = 0; it < iterations; it++) {
+        const AbendCodecRecord& s = samples[it % count];
+        raw.uptime = s.uptime; raw.reason = s.reason; raw.exccause = s.exccause;
+        raw.epc1 = s.epc1; raw.oom = s.oom;
+        memcpy(raw.gasp, s.gasp, sizeof(raw.gasp));
+        raw.crc = crc32(&raw, offsetof(RawAbendInfo, crc));
+        sink = sink + raw.crc;
+    }
+    double raw_ns = (nowNs() - t0) / iterations;
+
+    uint8_t buf[kAbendCodecMaxSize];
+    t0 = nowNs();
+    for (unsigned it = 0; it < iterations; it++) {
+        size_t n = abendCodecEncode(&samples[it % count], buf, sizeof(buf));
+        sink = sink + crc32(buf, n);
+    }
+    double enc_ns = (nowNs() - t0) / iterations;
+
+    std::vector<std::vector<uint8_t>> encoded;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = abendCodecEncode(&samples[i], buf, sizeof(buf));
+        encoded.emplace_back(buf, buf + n);
+    }
+    AbendCodecRecord rec;
+    t0 = nowNs();
+    for (unsigned it = 0; it < iterations; it++) {
+        const std::vector<uint8_t>& e = encoded[it % count];
+        sink = sink + abendCodecDecode(e.data(), e.size(), &rec);
+    }
+    double dec_ns = (nowNs() - t0) / iterations;
+
+    printf("Per record, %u iterations:\n", iterations);
+    printf("  raw copy + crc32   %8.1f ns\n", raw_ns);
+    printf("  encode + crc32     %8.1f ns\n", enc_ns);
+    printf("  decode             %8.1f ns\n", dec_ns);
+    return (int)(sink & 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 3 && 0 == strcmp(argv[1], "decode")) {
+        return decode(argv[2]);
+    }
+    if (argc >= 2 && 0 == strcmp(argv[1], "bench")) {
+        return bench((argc >= 3) ? strtoul(argv[2], NULL, 0) : 1000000u);
+    }
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s decode <hex>\n"
+        "  %s bench [iterations]\n", argv[0], argv[0]);
+    return 2;
+}
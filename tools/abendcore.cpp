@@ -0,0 +1,346 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool, converts an AbendInfo core dump into an Xtensa ELF core
+ * file for xtensa-lx106-elf-gdb
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendcore abendcore.cpp ../src/AbendLz.cpp
+ *
+ * Usage:
+ *   abendcore [-o offset] <firmware.elf> <dump.bin> <core.elf>
+ *   abendcore [-o offset] -b <firmware.elf> <dump.bin> ...   writes <dump.bin>.core
+ *
+ * dump.bin is the core dump region read with esptool.py read_flash. With a
+ * full flash image, offset is ABENDINFO_COREDUMP_ADDR. Then:
+ *   xtensa-lx106-elf-gdb firmware.elf core.elf
+ *
+ * The core file holds a PT_NOTE with an NT_PRSTATUS, in the layout gdb and
+ * BFD expect for Xtensa, and a PT_LOAD for each dumped DRAM segment. Only
+ * the registers known at the crash are filled: pc from epc1, a0 from
+ * excsave1, a1 from the stack pointer given to the crash callback, exccause,
+ * and excvaddr. Code comes from firmware.elf. Segment data is copied from
+ * the dump in blocks, or decoded a segment at a time when compressed, so
+ * memory use does not grow with the number of dumps. In batch mode the ELF
+ * is read once.
+ *
+ * Use the same ABENDINFO_LZ_... settings as the device build.
+ */
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "AbendCoreDump.h"
+#include "AbendLz.h"
+
+#ifndef EM_XTENSA
+#define EM_XTENSA 94
+#endif
+
+// Same algorithm as the Arduino ESP8266 Core's crc32()
+static uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff) {
+    const uint8_t *ldata = (const uint8_t *)data;
+    while (length--) {
+        uint8_t c = *ldata++;
+        for (uint32_t i = 0x80; i > 0; i >>= 1) {
+            bool bit = crc & 0x80000000u;
+            if (c & i) bit = !bit;
+            crc <<= 1;
+            if (bit) crc ^= 0x04c11db7u;
+        }
+    }
+    return crc;
+}
+
+/*
+  NT_PRSTATUS for Xtensa. BFD takes the registers from offset 72 to the end
+  less pr_fpvalid. The register block is xtensa_elf_gregset_t from gdb's
+  xtensa-tdep.h, 128 words with the address registers at word 64.
+*/
+struct XtensaGregset {
+    uint32_t pc;
+    uint32_t ps;
+    uint32_t lbeg;
+    uint32_t lend;
+    uint32_t lcount;
+    uint32_t sar;
+    uint32_t windowstart;
+    uint32_t windowbase;
+    uint32_t threadptr;
+    uint32_t reserved[7 + 48];
+    uint32_t ar[64];
+};
+static_assert(sizeof(XtensaGregset) == 128 * 4, "gregset layout");
+
+struct XtensaPrStatus {
+    uint32_t si_signo;
+    uint32_t si_code;
+    uint32_t si_errno;
+    uint16_t pr_cursig;
+    uint16_t pr_pad0;
+    uint32_t pr_sigpend;
+    uint32_t pr_sighold;
+    uint32_t pr_pid;
+    uint32_t pr_ppid;
+    uint32_t pr_pgrp;
+    uint32_t pr_sid;
+    uint32_t pr_time[8];        // utime, stime, cutime, cstime
+    XtensaGregset pr_reg;
+    uint32_t pr_fpvalid;
+};
+static_assert(offsetof(XtensaPrStatus, pr_reg) == 72 && sizeof(XtensaPrStatus) == 72 + 512 + 4, "prstatus layout");
+
+struct CoreNote {
+    Elf32_Nhdr     nhdr;
+    char           name[8];     // "CORE", padded to 4
+    XtensaPrStatus prstatus;
+};
+
+// From the firmware ELF, read once
+struct Firmware {
+    unsigned char  ident[EI_NIDENT];
+    uint32_t       flags;
+    std::vector<Elf32_Phdr> text;
+};
+
+static uint32_t dump_offset = 0;
+static std::vector<uint8_t> packed;     // reused across dumps
+static std::vector<uint8_t> unpacked;
+
+static bool loadFirmware(const char *path, Firmware& fw) {
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    Elf32_Ehdr eh;
+    bool ok = 1 == fread(&eh, sizeof(eh), 1, f) &&
+              0 == memcmp(eh.e_ident, ELFMAG, SELFMAG) &&
+              ELFCLASS32 == eh.e_ident[EI_CLASS] &&
+              ELFDATA2LSB == eh.e_ident[EI_DATA] &&
+              EM_XTENSA == eh.e_machine;
+    if (! ok) {
+        fprintf(stderr, "%s: not a little endian Xtensa ELF\n", path);
+        fclose(f);
+        return false;
+    }
+    memcpy(fw.ident, eh.e_ident, EI_NIDENT);
+    fw.flags = eh.e_flags;
+    for (size_t i = 0; i < eh.e_phnum; i++) {
+        Elf32_Phdr ph;
+        if (fseek(f, eh.e_phoff + i * eh.e_phentsize, SEEK_SET) || 1 != fread(&ph, sizeof(ph), 1, f)) break;
+        if (PT_LOAD == ph.p_type && (ph.p_flags & PF_X)) fw.text.push_back(ph);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool isFirmwareCode(const Firmware& fw, uint32_t pc) {
+    if (pc >= 0x40000000u && pc < 0x40010000u) return true;     // Boot ROM
+    for (const Elf32_Phdr& ph : fw.text) {
+        if (pc >= ph.p_vaddr && pc - ph.p_vaddr < ph.p_memsz) return true;
+    }
+    return false;
+}
+
+static uint32_t signalOf(const AbendCoreDumpHeader& hdr) {
+    if (2 != hdr.reason) return 6;      // not REASON_EXCEPTION_RST, SIGABRT
+    switch (hdr.exccause) {
+        case 0:  return 4;              // IllegalInstruction, SIGILL
+        case 6:  return 8;              // IntegerDivideByZero, SIGFPE
+        case 9:  return 7;              // LoadStoreAlignment, SIGBUS
+        default: return 11;             // SIGSEGV
+    }
+}
+
+static bool readAt(FILE *f, uint32_t ofs, void *buf, size_t len) {
+    return 0 == fseek(f, dump_offset + ofs, SEEK_SET) && len == fread(buf, 1, len, f);
+}
+
+static bool copySegment(FILE *in, FILE *out, const AbendCoreDumpHeader& hdr, const AbendCoreDumpSegment& s) {
+    if (hdr.flags & kAbendCoreDumpCompressed) {
+        packed.resize(s.stored);
+        unpacked.resize(s.size);
+        if (! readAt(in, s.offset, packed.data(), s.stored)) return false;
+        if (s.size != abendLzDecode(packed.data(), s.stored, unpacked.data(), s.size)) {
+            fprintf(stderr, "segment 0x%08x: malformed compressed data\n", s.addr);
+            return false;
+        }
+        return s.size == fwrite(unpacked.data(), 1, s.size, out);
+    }
+    uint8_t buf[64 * 1024];
+    if (fseek(in, dump_offset + s.offset, SEEK_SET)) return false;
+    for (uint32_t left = s.size; left; ) {
+        size_t n = (left < sizeof(buf)) ? left : sizeof(buf);
+        if (n != fread(buf, 1, n, in) || n != fwrite(buf, 1, n, out)) return false;
+        left -= n;
+    }
+    return true;
+}
+
+static bool convert(const Firmware& fw, const char *dump_path, const char *core_path) {
+    FILE *in = fopen(dump_path, "rb");
+    if (NULL == in) {
+        perror(dump_path);
+        return false;
+    }
+    AbendCoreDumpHeader hdr;
+    const char *err = NULL;
+    if (! readAt(in, 0, &hdr, sizeof(hdr))) {
+        err = "too short";
+    } else if (kAbendCoreDumpBlank == hdr.state) {
+        err = "empty region";
+    } else if (kAbendCoreDumpWriting == hdr.state) {
+        err = "dump did not finish";
+    } else if (kAbendCoreDumpComplete != hdr.state || ABENDCOREDUMP_MAGIC != hdr.magic) {
+        err = "not an AbendInfo core dump";
+    } else if (ABENDCOREDUMP_VERSION != hdr.version) {
+        err = "unsupported version";
+    } else if (hdr.crc != crc32(&hdr.magic, offsetof(struct AbendCoreDumpHeader, crc) - offsetof(struct AbendCoreDumpHeader, magic))) {
+        err = "header CRC mismatch";
+    } else if (hdr.count > kAbendCoreDumpSegments) {
+        err = "bad segment count";
+    }
+    if (err) {
+        fprintf(stderr, "%s: %s\n", dump_path, err);
+        fclose(in);
+        return false;
+    }
+    if (! isFirmwareCode(fw, hdr.epc1)) {
+        fprintf(stderr, "%s: warning, epc1 0x%08x is not in the firmware, is it the right ELF?\n", dump_path, hdr.epc1);
+    }
+
+    std::vector<AbendCoreDumpSegment> seg;
+    for (size_t i = 0; i < hdr.count; i++) {
+        if (hdr.segment[i].size) seg.push_back(hdr.segment[i]);
+    }
+
+    // ELF header, program headers, note, then segment data
+    const uint32_t phnum = 1 + seg.size();
+    const uint32_t note_ofs = sizeof(Elf32_Ehdr) + phnum * sizeof(Elf32_Phdr);
+    Elf32_Ehdr eh = {};
+    memcpy(eh.e_ident, fw.ident, EI_NIDENT);
+    eh.e_type      = ET_CORE;
+    eh.e_machine   = EM_XTENSA;
+    eh.e_version   = EV_CURRENT;
+    eh.e_phoff     = sizeof(Elf32_Ehdr);
+    eh.e_flags     = fw.flags;
+    eh.e_ehsize    = sizeof(Elf32_Ehdr);
+    eh.e_phentsize = sizeof(Elf32_Phdr);
+    eh.e_phnum     = phnum;
+
+    std::vector<Elf32_Phdr> ph(phnum);
+    ph[0].p_type   = PT_NOTE;
+    ph[0].p_offset = note_ofs;
+    ph[0].p_filesz = sizeof(CoreNote);
+    ph[0].p_align  = 4;
+    uint32_t ofs = note_ofs + sizeof(CoreNote);
+    for (size_t i = 0; i < seg.size(); i++) {
+        ph[i + 1].p_type   = PT_LOAD;
+        ph[i + 1].p_offset = ofs;
+        ph[i + 1].p_vaddr  = seg[i].addr;
+        ph[i + 1].p_paddr  = seg[i].addr;
+        ph[i + 1].p_filesz = seg[i].size;
+        ph[i + 1].p_memsz  = seg[i].size;
+        ph[i + 1].p_flags  = PF_R | PF_W;
+        ph[i + 1].p_align  = 4;
+        ofs += seg[i].size;
+    }
+
+    CoreNote note = {};
+    note.nhdr.n_namesz = 5;
+    note.nhdr.n_descsz = sizeof(XtensaPrStatus);
+    note.nhdr.n_type   = NT_PRSTATUS;
+    memcpy(note.name, "CORE", 5);
+    note.prstatus.si_signo  = signalOf(hdr);
+    note.prstatus.pr_cursig = note.prstatus.si_signo;
+    note.prstatus.pr_pid    = 1;
+    XtensaGregset& r = note.prstatus.pr_reg;
+    r.pc = hdr.epc1;
+    r.windowstart = 1;
+    r.ar[0] = hdr.excsave1;
+    r.ar[1] = hdr.stack;
+    // No slot for exccause and excvaddr in the gregset, kept where a reader
+    // of the note can find them.
+    r.reserved[0] = hdr.exccause;
+    r.reserved[1] = hdr.excvaddr;
+
+    FILE *out = fopen(core_path, "wb");
+    if (NULL == out) {
+        perror(core_path);
+        fclose(in);
+        return false;
+    }
+    bool ok = 1 == fwrite(&eh, sizeof(eh), 1, out) &&
+              phnum == fwrite(ph.data(), sizeof(Elf32_Phdr), phnum, out) &&
+              1 == fwrite(&note, sizeof(note), 1, out);
+    for (size_t i = 0; ok && i < seg.size(); i++) {
+        ok = copySegment(in, out, hdr, seg[i]);
+    }
+    ok = 0 == fclose(out) && ok;
+    fclose(in);
+    if (! ok) {
+        fprintf(stderr, "%s: failed writing %s\n", dump_path, core_path);
+        unlink(core_path);
+        return false;
+    }
+    printf("%s: EXCCAUSE %u @0x%08x, %zu segments, %u bytes%s -> %s\n",
+        dump_path, hdr.exccause, hdr.epc1, seg.size(), hdr.size,
+        (hdr.flags & (kAbendCoreDumpOutOfTime | kAbendCoreDumpOutOfSpace)) ? " (truncated)" : "",
+        core_path);
+    return true;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s [-o offset] <firmware.elf> <dump.bin> <core.elf>\n"
+        "  %s [-o offset] -b <firmware.elf> <dump.bin> ...\n",
+        name, name);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    bool batch = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "bo:")) != -1) {
+        if ('b' == opt) {
+            batch = true;
+        } else if ('o' == opt) {
+            dump_offset = strtoul(optarg, NULL, 0);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind < (batch ? 2 : 3)) usage(argv[0]);
+
+    Firmware fw;
+    if (! loadFirmware(argv[optind], fw)) return 1;
+    if (batch) {
+        int failed = 0;
+        for (int i = optind + 1; i < argc; i++) {
+            std::string core = std::string(argv[i]) + ".core";
+            if (! convert(fw, argv[i], core.c_str())) failed++;
+        }
+        if (failed) fprintf(stderr, "%d of %d dumps failed\n", failed, argc - optind - 1);
+        return failed ? 1 : 0;
+    }
+    if (argc - optind != 3) usage(argv[0]);
+    return convert(fw, argv[optind + 1], argv[optind + 2]) ? 0 : 1;
+}
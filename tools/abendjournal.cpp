@@ -0,0 +1,153 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool for the AbendInfo flash crash journal
+ *
+ * Reads a flash image pulled from a device, e.g. with
+ *   esptool.py read_flash 0 0x400000 flash.bin
+ * or works with a file used to emulate the flash. Erase fills a sector with
+ * 0xFF and writes can only clear bits, the same as NOR flash. Appending to a
+ * missing file creates it.
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendjournal abendjournal.cpp ../src/AbendJournal.cpp
+ *
+ * Usage:
+ *   abendjournal [-o offset] [-n sectors] [-s sector_size] <flash.bin> list [count]
+ *   abendjournal [-o offset] [-n sectors] [-s sector_size] <flash.bin> append <reason> <exccause> <epc1> [uptime [gasp]]
+ *
+ * offset is ABENDINFO_JOURNAL_ADDR and sectors is ABENDINFO_JOURNAL_SECTORS
+ * from the device build.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "AbendJournal.h"
+
+static FILE *flash_file = NULL;
+
+static bool fileRead(uint32_t addr, void *buf, size_t len) {
+    memset(buf, 0xff, len);
+    if (fseek(flash_file, addr, SEEK_SET)) return false;
+    fread(buf, 1, len, flash_file);     // short read past EOF stays erased
+    return true;
+}
+
+static bool fileWrite(uint32_t addr, const void *buf, size_t len) {
+    std::vector<uint8_t> cur(len);
+    fileRead(addr, cur.data(), len);
+    const uint8_t *src = (const uint8_t *)buf;
+    for (size_t i = 0; i < len; i++) cur[i] &= src[i];
+    if (fseek(flash_file, addr, SEEK_SET)) return false;
+    return len == fwrite(cur.data(), 1, len, flash_file) && 0 == fflush(flash_file);
+}
+
+static uint32_t sector_size = 4096;
+
+static bool fileErase(uint32_t addr) {
+    std::vector<uint8_t> erased(sector_size, 0xff);
+    if (fseek(flash_file, addr, SEEK_SET)) return false;
+    return sector_size == fwrite(erased.data(), 1, sector_size, flash_file) && 0 == fflush(flash_file);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s [-o offset] [-n sectors] [-s sector_size] <flash.bin> list [count]\n"
+        "  %s [-o offset] [-n sectors] [-s sector_size] <flash.bin> append <reason> <exccause> <epc1> [uptime [gasp]]\n",
+        name, name);
+    exit(2);
+}
+
+static void printRecord(const AbendJournalRecord& rec) {
+    printf("  #%-5u reason %3u  EXCCAUSE %2u @0x%08x  uptime %u sec",
+        rec.seq, rec.reason, rec.exccause, rec.epc1, rec.uptime);
+    if (rec.oom) printf(", OOM %u", rec.oom);
+    if (rec.gasp[0]) printf(", '%s'", rec.gasp);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t offset = 0;
+    uint32_t sectors = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:n:s:")) != -1) {
+        switch (opt) {
+            case 'o': offset = strtoul(optarg, NULL, 0); break;
+            case 'n': sectors = strtoul(optarg, NULL, 0); break;
+            case 's': sector_size = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind < 2) usage(argv[0]);
+    const char *path = argv[optind];
+    const char *cmd  = argv[optind + 1];
+    char **args = &argv[optind + 2];
+    int nargs = argc - optind - 2;
+    bool append = (0 == strcmp(cmd, "append"));
+    if (!append && strcmp(cmd, "list")) usage(argv[0]);
+    if (append && nargs < 3) usage(argv[0]);
+
+    flash_file = fopen(path, "r+b");
+    if (NULL == flash_file && append) flash_file = fopen(path, "w+b");
+    if (NULL == flash_file) {
+        perror(path);
+        return 1;
+    }
+
+    AbendJournal journal = {};
+    journal.flash.read  = fileRead;
+    journal.flash.write = fileWrite;
+    journal.flash.erase = fileErase;
+    journal.base        = offset;
+    journal.sectors     = sectors;
+    journal.sector_size = sector_size;
+    if (! abendJournalMount(&journal)) {
+        fprintf(stderr, "Journal mount failed\n");
+        return 1;
+    }
+
+    if (append) {
+        AbendJournalRecord rec = {};
+        rec.reason   = strtoul(args[0], NULL, 0);
+        rec.exccause = strtoul(args[1], NULL, 0);
+        rec.epc1     = strtoul(args[2], NULL, 0);
+        if (nargs > 3) rec.uptime = strtoul(args[3], NULL, 0);
+        if (nargs > 4) strncpy(rec.gasp, args[4], sizeof(rec.gasp) - 1);
+        if (! abendJournalAppend(&journal, &rec)) {
+            fprintf(stderr, "Journal append failed\n");
+            return 1;
+        }
+        printRecord(rec);
+    } else {
+        uint32_t total = abendJournalCount(&journal);
+        uint32_t count = (nargs > 0) ? strtoul(args[0], NULL, 0) : total;
+        printf("Flash Crash Journal: %u records, active sector %u, %u slots used\n",
+            total, journal.active, journal.used);
+        for (uint32_t age = 0; age < count && age < total; age++) {
+            AbendJournalRecord rec;
+            if (abendJournalRead(&journal, age, &rec)) {
+                printRecord(rec);
+            } else {
+                printf("  #%-5u (damaged)\n", journal.latest_seq - age);
+            }
+        }
+    }
+    fclose(flash_file);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool for the AbendInfo LZ compressor
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendlz abendlz.cpp ../src/AbendLz.cpp
+ *
+ * Usage:
+ *   abendlz compress <in> <out>
+ *   abendlz decompress <in> <out> <size>   size is the uncompressed length
+ *   abendlz bench [image ...]              Ratio and speed, synthetic stack
+ *                                          images when no files are given
+ *
+ * Use the same ABENDINFO_LZ_... settings as the device build.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "AbendLz.h"
+
+static bool appendOut(void *ctx, const uint8_t *buf, size_t len) {
+    std::vector<uint8_t> *out = (std::vector<uint8_t> *)ctx;
+    out->insert(out->end(), buf, buf + len);
+    return true;
+}
+
+static std::vector<uint8_t> compress(const std::vector<uint8_t>& in, size_t chunk = 256) {
+    static AbendLzEncoder lz;
+    std::vector<uint8_t> out;
+    abendLzInit(&lz, appendOut, &out);
+    for (size_t pos = 0; pos < in.size(); pos += chunk) {
+        size_t n = (in.size() - pos < chunk) ? in.size() - pos : chunk;
+        abendLzWrite(&lz, &in[pos], n);
+    }
+    abendLzFinish(&lz);
+    return out;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t>& data) {
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return true;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t>& data) {
+    FILE *f = fopen(path, "wb");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    bool ok = data.size() == fwrite(data.data(), 1, data.size(), f);
+    return 0 == fclose(f) && ok;
+}
+
+/*
+  Synthetic images in the style of a captured ESP8266 stack: unused stack
+  filled with zeros, frames holding return addresses into flash and IRAM,
+  pointers into DRAM, and small integers.
+*/
+static std::vector<uint8_t> stackImage(size_t size, uint32_t used_pct, uint32_t seed) {
+    std::vector<uint8_t> img(size, 0);
+    srand(seed);
+    const uint32_t pcs[] = { 0x40201e6cu, 0x40203f10u, 0x4020a1b4u, 0x40100a2cu, 0x4021c3e8u };
+    const uint32_t ptrs[] = { 0x3fffff20u, 0x3ffef2a0u, 0x3ffe8810u, 0x3fffdab0u };
+    size_t start = size - size * used_pct / 100u;
+    for (size_t ofs = start & ~3u; ofs + 4 <= size; ofs += 4) {
+        uint32_t v;
+        switch (rand() % 8) {
+            case 0: case 1: v = pcs[rand() % 5]; break;
+            case 2: case 3: v = ptrs[rand() % 4] + (rand() % 16) * 4; break;
+            case 4: v = rand() % 256; break;
+            case 5: v = (uint32_t)rand() * 2654435761u; break;
+            default: v = 0; break;
+        }
+        memcpy(&img[ofs], &v, 4);
+    }
+    return img;
+}
+
+static inline uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static bool benchOne(const char *name, const std::vector<uint8_t>& img) {
+    std::vector<uint8_t> packed = compress(img);
+    std::vector<uint8_t> back(img.size());
+    size_t n = abendLzDecode(packed.data(), packed.size(), back.data(), back.size());
+    if (n != img.size() || back != img) {
+        printf("  %-24s round trip FAILED\n", name);
+        return false;
+    }
+    const int reps = 50;
+    uint64_t t0 = cycles();
+    for (int i = 0; i < reps; i++) compress(img);
+    double enc = (double)(cycles() - t0) / reps / img.size();
+    t0 = cycles();
+    for (int i = 0; i < reps; i++) abendLzDecode(packed.data(), packed.size(), back.data(), back.size());
+    double dec = (double)(cycles() - t0) / reps / img.size();
+    printf("  %-24s %6zu -> %6zu bytes  %5.1f:1  encode %6.1f  decode %5.1f cycles/byte\n",
+        name, img.size(), packed.size(), (double)img.size() / packed.size(), enc, dec);
+    return true;
+}
+
+static int bench(int argc, char *argv[]) {
+    printf("Window %zu bytes, match %zu - %zu bytes, chain depth %u, encoder state %zu bytes\n",
+        kAbendLzWindow, kAbendLzMinMatch, kAbendLzMaxMatch, ABENDINFO_LZ_DEPTH, sizeof(AbendLzEncoder));
+    printf("Host cycles, not ESP8266 cycles\n");
+    bool ok = true;
+    if (argc) {
+        for (int i = 0; i < argc; i++) {
+            std::vector<uint8_t> img;
+            if (! readFile(argv[i], img)) return 1;
+            ok &= benchOne(argv[i], img);
+        }
+    } else {
+        ok &= benchOne("CONT stack 4K, 25% used", stackImage(4096, 25, 1));
+        ok &= benchOne("CONT stack 4K, 60% used", stackImage(4096, 60, 2));
+        ok &= benchOne("SYS stack 5K, 40% used", stackImage(5248, 40, 3));
+        ok &= benchOne("zeros 16K", std::vector<uint8_t>(16384, 0));
+        std::vector<uint8_t> noise(4096);
+        srand(4);
+        for (auto& b : noise) b = (uint8_t)rand();
+        ok &= benchOne("random 4K, worst case", noise);
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && 0 == strcmp(argv[1], "bench")) {
+        return bench(argc - 2, &argv[2]);
+    }
+    if (argc == 4 && 0 == strcmp(argv[1], "compress")) {
+        std::vector<uint8_t> in;
+        if (! readFile(argv[2], in)) return 1;
+        std::vector<uint8_t> out = compress(in);
+        printf("%zu -> %zu bytes\n", in.size(), out.size());
+        return writeFile(argv[3], out) ? 0 : 1;
+    }
+    if (argc == 5 && 0 == strcmp(argv[1], "decompress")) {
+        std::vector<uint8_t> in;
+        if (! readFile(argv[2], in)) return 1;
+        std::vector<uint8_t> out(strtoul(argv[4], NULL, 0));
+        size_t n = abendLzDecode(in.data(), in.size(), out.data(), out.size());
+        if (SIZE_MAX == n) {
+            fprintf(stderr, "Malformed input or size too small\n");
+            return 1;
+        }
+        out.resize(n);
+        return writeFile(argv[3], out) ? 0 : 1;
+    }
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s compress <in> <out>\n"
+        "  %s decompress <in> <out> <size>\n"
+        "  %s bench [image ...]\n", argv[0], argv[0], argv[0]);
+    return 2;
+}
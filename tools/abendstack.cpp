@@ -0,0 +1,212 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool, decodes the stack window of a firmware built with
+ * ABENDINFO_STACK_WINDOW and looks up its code addresses
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendstack abendstack.cpp ../src/AbendStackWindow.cpp
+ *
+ * Usage:
+ *   abendstack [-a] [-e firmware.elf] [log.txt]
+ *
+ * The log is the serial output with abendInfoReport's "stk" lines, read from
+ * stdin when not given. Every window in the log is decoded. For each word
+ * that is a code address the stack address, its offset from the stack
+ * pointer, and the function from the ELF's symbols are printed. With -a the
+ * other nonzero words of a window saved without filtering are printed too.
+ * The code addresses are repeated in an addr2line command line for source
+ * lines.
+ *
+ * Code addresses found on the stack are return addresses, but also function
+ * pointers and stale values of returned calls. Read the list bottom up, as
+ * a hint for the call chain, not as a backtrace.
+ */
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "AbendStackWindow.h"
+
+#ifndef EM_XTENSA
+#define EM_XTENSA 94
+#endif
+
+// Instruction address space, the same test as is_pc_valid() on the device
+static bool isCodeAddress(uint32_t pc) {
+    return pc >= 0x40000000u && pc < 0x40300000u;
+}
+
+struct Symbol {
+    uint32_t start;
+    uint32_t size;
+    std::string name;
+};
+
+static bool loadSymbols(const char *path, std::vector<Symbol>& sym) {
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    std::vector<uint8_t> raw;
+    fseek(f, 0, SEEK_END);
+    raw.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    bool ok = raw.size() == fread(raw.data(), 1, raw.size(), f);
+    fclose(f);
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)raw.data();
+    ok = ok && raw.size() >= sizeof(Elf32_Ehdr) &&
+         0 == memcmp(eh->e_ident, ELFMAG, SELFMAG) &&
+         ELFCLASS32 == eh->e_ident[EI_CLASS] &&
+         ELFDATA2LSB == eh->e_ident[EI_DATA] &&
+         EM_XTENSA == eh->e_machine &&
+         eh->e_shoff + eh->e_shnum * sizeof(Elf32_Shdr) <= raw.size();
+    if (! ok) {
+        fprintf(stderr, "%s: not a little endian Xtensa ELF\n", path);
+        return false;
+    }
+    const Elf32_Shdr *sh = (const Elf32_Shdr *)&raw[eh->e_shoff];
+    for (size_t i = 0; i < eh->e_shnum; i++) {
+        if (SHT_SYMTAB != sh[i].sh_type) continue;
+        const Elf32_Shdr& str = sh[sh[i].sh_link];
+        const Elf32_Sym *s = (const Elf32_Sym *)&raw[sh[i].sh_offset];
+        for (size_t k = 0; k < sh[i].sh_size / sizeof(Elf32_Sym); k++) {
+            if (STT_FUNC != ELF32_ST_TYPE(s[k].st_info) || 0 == s[k].st_size) continue;
+            sym.push_back({ s[k].st_value, s[k].st_size,
+                            (const char *)&raw[str.sh_offset + s[k].st_name] });
+        }
+    }
+    std::sort(sym.begin(), sym.end(), [](const Symbol& a, const Symbol& b) { return a.start < b.start; });
+    return true;
+}
+
+// The function containing pc, NULL when none does
+static const Symbol *findSymbol(const std::vector<Symbol>& sym, uint32_t pc) {
+    auto it = std::upper_bound(sym.begin(), sym.end(), pc,
+        [](uint32_t v, const Symbol& s) { return v < s.start; });
+    if (it == sym.begin()) return NULL;
+    --it;
+    return (pc - it->start < it->size) ? &*it : NULL;
+}
+
+struct Window {
+    uint32_t sp;
+    uint32_t stack_end;
+    uint32_t words;
+    uint32_t filter;
+    std::vector<uint32_t> code;
+};
+
+static void printWindow(const Window& w, const std::vector<Symbol>& sym, bool all, const char *elf) {
+    std::vector<uint32_t> stack(w.words);
+    const size_t n = abendStackRleDecode(w.code.data(), w.code.size(), stack.data(), stack.size());
+    printf("sp 0x%08x, end 0x%08x, %u words%s\n", w.sp, w.stack_end, w.words,
+        (w.filter) ? ", code addresses only" : "");
+    if (n != w.words) {
+        printf("  only %zu words decoded, the log is incomplete\n", n);
+    }
+    std::vector<uint32_t> pcs;
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t v = stack[i];
+        const bool pc = isCodeAddress(v);
+        if (0 == v || (!pc && !all)) continue;
+        printf("  sp+0x%03zx  0x%08zx  0x%08x", 4u * i, w.sp + 4u * i, v);
+        if (pc) {
+            // A return address is after the call, look up the call
+            const Symbol *s = findSymbol(sym, v - 1u);
+            if (s) printf("  %s+0x%x", s->name.c_str(), v - s->start);
+            pcs.push_back(v);
+        }
+        printf("\n");
+    }
+    if (pcs.size()) {
+        printf("xtensa-lx106-elf-addr2line -pfiaC -e %s", (elf) ? elf : "firmware.elf");
+        for (uint32_t pc : pcs) printf(" 0x%08x", pc);
+        printf("\n");
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    bool all = false;
+    const char *elf = NULL;
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "ae:"))) {
+        switch (opt) {
+            case 'a':
+                all = true;
+                break;
+            case 'e':
+                elf = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a] [-e firmware.elf] [log.txt]\n", argv[0]);
+                return 2;
+        }
+    }
+    std::vector<Symbol> sym;
+    if (elf && ! loadSymbols(elf, sym)) return 1;
+    FILE *in = stdin;
+    if (optind < argc) {
+        in = fopen(argv[optind], "r");
+        if (NULL == in) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    std::vector<Window> found;
+    Window w = {};
+    bool open = false;
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        const char *p = strstr(line, "stk ");
+        if (NULL == p) {
+            if (open) found.push_back(w);
+            open = false;
+            continue;
+        }
+        p += 4;
+        if (4 == sscanf(p, "sp 0x%x end 0x%x words %u filter %u", &w.sp, &w.stack_end, &w.words, &w.filter)) {
+            if (open) found.push_back(w);
+            w.code.clear();
+            open = w.words <= kAbendStackRleMaxCount;
+            continue;
+        }
+        if (! open) continue;
+        char *end;
+        for (;;) {
+            const unsigned long v = strtoul(p, &end, 16);
+            if (end == p) break;
+            w.code.push_back((uint32_t)v);
+            p = end;
+        }
+    }
+    if (open) found.push_back(w);
+    if (in != stdin) fclose(in);
+
+    if (found.empty()) {
+        fprintf(stderr, "No stack window found, look for \"stk\" lines in the log\n");
+        return 1;
+    }
+    for (const Window& fw : found) printWindow(fw, sym, all, elf);
+    return 0;
+}
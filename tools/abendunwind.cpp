@@ -0,0 +1,426 @@
+/*
+ *   Copyright 2023 M Hightower
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+/*
+ * Linux host tool, fills in the call0 unwind table of a firmware built with
+ * ABENDINFO_UNWIND_TABLE
+ *
+ * Build:
+ *   g++ -O2 -Wall -I../src -o abendunwind abendunwind.cpp
+ *
+ * Usage:
+ *   abendunwind [-v] <firmware.elf> [firmware.bin]
+ *
+ * Run after linking and before uploading. The table, symbol abendUnwindTable,
+ * is rewritten in the ELF, and in the .bin when given. The .bin is the one
+ * made by the Arduino ESP8266 Core's elf2bin.py, the app image starts at
+ * 0x1000, and its checksum is updated. A signed or MD5 checked OTA image
+ * must be signed or summed again afterwards.
+ *
+ * Each function symbol's prologue is decoded for the call0 ABI: the stack
+ * adjustment by addi, addmi, or movi and add/sub of a1, and the store of a0
+ * by s32i or s32i.n. Functions that set up a frame pointer in a15, or whose
+ * prologue is not understood, get an entry that stops unwinding. So do gaps
+ * of 16 bytes or more between functions, eg. literal pools.
+ */
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "AbendUnwind.h"
+
+#ifndef EM_XTENSA
+#define EM_XTENSA 94
+#endif
+
+constexpr uint32_t kAppImage   = 0x1000u;   // elf2bin.py, after eboot
+constexpr uint32_t kMinGap     = 16u;
+constexpr size_t   kMaxPrologue = 24u;      // instructions looked at
+
+static bool verbose = false;
+
+static bool readFile(const char *path, std::vector<uint8_t>& buf) {
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    buf.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    bool ok = buf.size() == fread(buf.data(), 1, buf.size(), f);
+    fclose(f);
+    if (! ok) fprintf(stderr, "%s: read failed\n", path);
+    return ok;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t>& buf) {
+    FILE *f = fopen(path, "r+b");
+    if (NULL == f) {
+        perror(path);
+        return false;
+    }
+    bool ok = buf.size() == fwrite(buf.data(), 1, buf.size(), f);
+    ok = 0 == fclose(f) && ok;
+    if (! ok) fprintf(stderr, "%s: write failed\n", path);
+    return ok;
+}
+
+struct Elf {
+    std::vector<uint8_t> raw;
+    const Elf32_Ehdr *eh;
+    const Elf32_Shdr *sh;
+
+    // File offset of len bytes at vaddr, in a section with file contents
+    const Elf32_Shdr *section(uint32_t vaddr, uint32_t len) const {
+        for (size_t i = 0; i < eh->e_shnum; i++) {
+            const Elf32_Shdr& s = sh[i];
+            if (SHT_PROGBITS == s.sh_type && (s.sh_flags & SHF_ALLOC) &&
+                vaddr >= s.sh_addr && vaddr - s.sh_addr + len <= s.sh_size) {
+                return &s;
+            }
+        }
+        return NULL;
+    }
+    uint8_t *at(uint32_t vaddr, uint32_t len) {
+        const Elf32_Shdr *s = section(vaddr, len);
+        return (s) ? &raw[s->sh_offset + vaddr - s->sh_addr] : NULL;
+    }
+};
+
+static bool loadElf(const char *path, Elf& elf) {
+    if (! readFile(path, elf.raw)) return false;
+    elf.eh = (const Elf32_Ehdr *)elf.raw.data();
+    bool ok = elf.raw.size() >= sizeof(Elf32_Ehdr) &&
+              0 == memcmp(elf.eh->e_ident, ELFMAG, SELFMAG) &&
+              ELFCLASS32 == elf.eh->e_ident[EI_CLASS] &&
+              ELFDATA2LSB == elf.eh->e_ident[EI_DATA] &&
+              EM_XTENSA == elf.eh->e_machine &&
+              elf.eh->e_shoff + elf.eh->e_shnum * sizeof(Elf32_Shdr) <= elf.raw.size();
+    if (! ok) {
+        fprintf(stderr, "%s: not a little endian Xtensa ELF\n", path);
+        return false;
+    }
+    elf.sh = (const Elf32_Shdr *)&elf.raw[elf.eh->e_shoff];
+    return true;
+}
+
+struct Function {
+    uint32_t start;
+    uint32_t size;
+};
+
+// Function symbols in code, sorted and without aliases. Also finds the table.
+static bool readSymbols(Elf& elf, std::vector<Function>& fn, uint32_t& table) {
+    table = 0;
+    for (size_t i = 0; i < elf.eh->e_shnum; i++) {
+        const Elf32_Shdr& s = elf.sh[i];
+        if (SHT_SYMTAB != s.sh_type) continue;
+        const Elf32_Shdr& str = elf.sh[s.sh_link];
+        const Elf32_Sym *sym = (const Elf32_Sym *)&elf.raw[s.sh_offset];
+        for (size_t k = 0; k < s.sh_size / sizeof(Elf32_Sym); k++) {
+            const char *name = (const char *)&elf.raw[str.sh_offset + sym[k].st_name];
+            if (0 == strcmp(name, "abendUnwindTable")) {
+                table = sym[k].st_value;
+            }
+            if (STT_FUNC != ELF32_ST_TYPE(sym[k].st_info) || 0 == sym[k].st_size ||
+                sym[k].st_shndx >= elf.eh->e_shnum ||
+                !(elf.sh[sym[k].st_shndx].sh_flags & SHF_EXECINSTR)) {
+                continue;
+            }
+            fn.push_back({ sym[k].st_value, sym[k].st_size });
+        }
+    }
+    std::sort(fn.begin(), fn.end(), [](const Function& a, const Function& b) { return a.start < b.start; });
+    fn.erase(std::unique(fn.begin(), fn.end(), [](const Function& a, const Function& b) { return a.start == b.start; }), fn.end());
+    return true;
+}
+
+static int32_t signExtend(uint32_t v, unsigned bits) {
+    const uint32_t m = 1u << (bits - 1u);
+    return (int32_t)((v ^ m) - m);
+}
+
+// A call0 or callx0 anywhere in the function
+static bool makesCall(const uint8_t *code, uint32_t size) {
+    for (uint32_t pc = 0; pc + 2u <= size; ) {
+        const uint32_t op0 = code[pc] & 0x0fu;
+        if (op0 >= 8u && op0 <= 0x0du) {
+            pc += 2u;
+            continue;
+        }
+        if (pc + 3u > size) break;
+        const uint32_t insn = code[pc] | (code[pc + 1] << 8) | (code[pc + 2] << 16);
+        if ((0x5u == op0 && 0u == ((insn >> 4) & 3u)) ||       // call0
+            (0x0000c0u == (insn & 0xfff0ffu))) {                // callx0
+            return true;
+        }
+        pc += 3u;
+    }
+    return false;
+}
+
+/*
+  Decode the prologue of one function. Returns false when it can not be
+  unwound, a frame pointer or a stack adjustment not understood.
+*/
+static bool decodePrologue(const uint8_t *code, uint32_t size, AbendUnwindEntry& e) {
+    int32_t reg[16];
+    bool known[16] = {};
+    uint32_t frame = 0, ra_ofs = 0, ra_frame = 0, setup = 0;
+    bool saved = false;
+    uint32_t pc = 0;
+    for (size_t n = 0; n < kMaxPrologue && pc + 2u <= size; n++) {
+        const uint32_t op0 = code[pc] & 0x0fu;
+        const uint32_t len = (op0 >= 8u && op0 <= 0x0du) ? 2u : 3u;
+        if (pc + len > size) break;
+        uint32_t insn = code[pc] | (code[pc + 1] << 8);
+        if (3u == len) insn |= code[pc + 2] << 16;
+        const uint32_t t = (insn >> 4) & 0x0fu;
+        const uint32_t s = (insn >> 8) & 0x0fu;
+        const uint32_t r = (insn >> 12) & 0x0fu;
+        const uint32_t op1 = (insn >> 16) & 0x0fu;
+        const uint32_t op2 = (insn >> 20) & 0x0fu;
+        const uint32_t imm8 = (insn >> 16) & 0xffu;
+        pc += len;
+        bool end = false;
+        switch (op0) {
+            case 0x0:   // RRR
+                if (0 == op1 && 0 == op2) {
+                    end = true;                         // ret, callx, jx, ...
+                } else if (0 == op1 && (0xc == op2 || 0x8 == op2) && 1u == r && 1u == s) {
+                    if (! known[t]) return false;       // sub/add a1, a1, at
+                    const int32_t down = (0xc == op2) ? reg[t] : -reg[t];
+                    if (down <= 0) {
+                        end = true;                     // epilogue
+                        break;
+                    }
+                    frame += down;
+                    setup = pc;
+                } else if (0 == op1 && 0x2 == op2 && 15u == r && 1u == s && 1u == t) {
+                    return false;                       // mov a15, a1
+                } else if (r < 16u) {
+                    known[r] = false;
+                }
+                break;
+            case 0x2:   // LSAI
+                if ((0xc == r || 0xd == r) && 1u == t && 1u == s) { // addi, addmi a1, a1, imm
+                    const int32_t down = -signExtend(imm8, 8) * ((0xd == r) ? 256 : 1);
+                    if (down <= 0) {
+                        end = true;                                 // epilogue
+                        break;
+                    }
+                    frame += down;
+                    setup = pc;
+                } else if (0xa == r) {                              // movi at, imm12
+                    reg[t] = signExtend((s << 8) | imm8, 12);
+                    known[t] = true;
+                } else if (0x6 == r && 0u == t && 1u == s && !saved) {  // s32i a0, a1, imm8 * 4
+                    ra_ofs = imm8 * 4u;
+                    ra_frame = frame;
+                    saved = true;
+                    setup = pc;
+                } else if (r < 4u || 0x9 == r || 0xb == r || 0xc == r || 0xd == r) {
+                    known[t] = false;                               // loads, addi
+                }
+                break;
+            case 0x9:   // s32i.n
+                if (0u == t && 1u == s && !saved) {
+                    ra_ofs = r * 4u;
+                    ra_frame = frame;
+                    saved = true;
+                    setup = pc;
+                }
+                break;
+            case 0xa:   // add.n ar, as, at
+                if (1u == r && 1u == s) {
+                    if (! known[t]) return false;
+                    if (reg[t] >= 0) {
+                        end = true;
+                        break;
+                    }
+                    frame -= reg[t];
+                    setup = pc;
+                } else {
+                    known[r] = false;
+                }
+                break;
+            case 0xc:   // movi.n, beqz.n, bnez.n
+                if (insn & 0x80u) {
+                    end = true;
+                } else {
+                    const uint32_t imm7 = ((insn >> 4) & 0x07u) << 4 | r;
+                    reg[s] = (imm7 >= 96u) ? (int32_t)imm7 - 128 : (int32_t)imm7;
+                    known[s] = true;
+                }
+                break;
+            case 0xd:   // mov.n, ret.n, ...
+                if (0xf == r) {
+                    end = true;
+                } else if (0 == r && 15u == t && 1u == s) {
+                    return false;                       // mov.n a15, a1
+                } else if (0 == r) {
+                    known[t] = false;
+                }
+                break;
+            case 0x5:   // call
+            case 0x6:   // j, branches
+            case 0x7:   // branches
+                end = true;
+                break;
+            default:
+                if (op0 == 0x1 || op0 == 0x8 || op0 == 0xb) {
+                    known[t] = false;                   // l32r, l32i.n, addi.n
+                    if (0xb == op0) known[r] = false;
+                }
+                break;
+        }
+        if (end) break;
+    }
+    if ((int32_t)frame < 0 || frame >= kAbendUnwindUnknown || (frame & 3u) || setup > 255u) return false;
+    if (! saved && makesCall(code, size)) return false;    // a0 saved some other way
+    e.frame = frame;
+    e.setup = setup;
+    e.ra    = kAbendUnwindLeaf;
+    if (saved) {
+        // Offset in the frame as finally set up
+        const uint32_t ofs = ra_ofs + (frame - ra_frame);
+        if (ofs + 4u > frame || ofs / 4u >= kAbendUnwindLeaf) return false;
+        e.ra = ofs / 4u;
+    }
+    return true;
+}
+
+// The app image of an elf2bin.py .bin, checksum 0xef xor all segment data
+static bool patchBin(const char *path, uint32_t vaddr, const std::vector<uint8_t>& table) {
+    std::vector<uint8_t> bin;
+    if (! readFile(path, bin)) return false;
+    auto le32 = [&](uint32_t ofs) { return bin[ofs] | bin[ofs + 1] << 8 | bin[ofs + 2] << 16 | (uint32_t)bin[ofs + 3] << 24; };
+    if (bin.size() < kAppImage + 8u || 0xe9 != bin[kAppImage]) {
+        fprintf(stderr, "%s: no app image at 0x%x\n", path, kAppImage);
+        return false;
+    }
+    uint32_t pos = kAppImage + 8u, table_ofs = 0;
+    uint8_t sum = 0xef;
+    for (size_t i = 0; i < bin[kAppImage + 1]; i++) {
+        if (pos + 8u > bin.size()) return false;
+        const uint32_t addr = le32(pos), size = le32(pos + 4u);
+        pos += 8u;
+        if (pos + size > bin.size()) {
+            fprintf(stderr, "%s: truncated segment\n", path);
+            return false;
+        }
+        if (vaddr >= addr && vaddr - addr + table.size() <= size) table_ofs = pos + vaddr - addr;
+        for (uint32_t k = 0; k < size; k++) sum ^= bin[pos + k];
+        pos += size;
+    }
+    const uint32_t chk = kAppImage + ((pos - kAppImage) | 15u);
+    if (chk >= bin.size() || sum != bin[chk]) {
+        fprintf(stderr, "%s: app image checksum mismatch, not an elf2bin.py image?\n", path);
+        return false;
+    }
+    if (0 == table_ofs || ABENDUNWIND_MAGIC != le32(table_ofs)) {
+        fprintf(stderr, "%s: unwind table not found, is it the .bin of this ELF?\n", path);
+        return false;
+    }
+    for (size_t k = 0; k < table.size(); k++) {
+        sum ^= bin[table_ofs + k] ^ table[k];
+        bin[table_ofs + k] = table[k];
+    }
+    bin[chk] = sum;
+    return writeFile(path, bin);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        if ('v' == opt) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Usage:\n  %s [-v] <firmware.elf> [firmware.bin]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        fprintf(stderr, "Usage:\n  %s [-v] <firmware.elf> [firmware.bin]\n", argv[0]);
+        return 2;
+    }
+    const char *elf_path = argv[optind];
+    Elf elf;
+    std::vector<Function> fn;
+    uint32_t vaddr;
+    if (! loadElf(elf_path, elf) || ! readSymbols(elf, fn, vaddr)) return 1;
+    const uint8_t *hdr_raw = (vaddr) ? elf.at(vaddr, sizeof(AbendUnwindHeader)) : NULL;
+    if (NULL == hdr_raw) {
+        fprintf(stderr, "%s: no abendUnwindTable, build with ABENDINFO_UNWIND_TABLE\n", elf_path);
+        return 1;
+    }
+    AbendUnwindHeader hdr;
+    memcpy(&hdr, hdr_raw, sizeof(hdr));
+    if (ABENDUNWIND_MAGIC != hdr.magic) {
+        fprintf(stderr, "%s: abendUnwindTable has a bad magic\n", elf_path);
+        return 1;
+    }
+
+    std::vector<AbendUnwindEntry> entry;
+    size_t leaf = 0, unknown = 0;
+    for (size_t i = 0; i < fn.size(); i++) {
+        const uint8_t *code = elf.at(fn[i].start, fn[i].size);
+        AbendUnwindEntry e = { fn[i].start, kAbendUnwindUnknown, kAbendUnwindLeaf, 0 };
+        if (NULL == code || ! decodePrologue(code, fn[i].size, e)) {
+            e.frame = kAbendUnwindUnknown;
+            e.ra    = kAbendUnwindLeaf;
+            e.setup = 0;
+            unknown++;
+        } else if (kAbendUnwindLeaf == e.ra) {
+            leaf++;
+        }
+        if (verbose) {
+            printf("0x%08x %6u frame %5u ra %3d setup %3u\n", e.start, fn[i].size,
+                e.frame, (kAbendUnwindLeaf == e.ra) ? -1 : e.ra, e.setup);
+        }
+        entry.push_back(e);
+        const uint32_t end = fn[i].start + fn[i].size;
+        if (i + 1u == fn.size() || fn[i + 1u].start >= end + kMinGap) {
+            entry.push_back({ end, kAbendUnwindUnknown, kAbendUnwindLeaf, 0 });
+        }
+    }
+
+    hdr.functions = entry.size();
+    hdr.count = (entry.size() <= hdr.capacity) ? entry.size() : 0;
+    std::vector<uint8_t> table(sizeof(hdr) + hdr.count * sizeof(AbendUnwindEntry));
+    memcpy(table.data(), &hdr, sizeof(hdr));
+    if (hdr.count) memcpy(&table[sizeof(hdr)], entry.data(), hdr.count * sizeof(AbendUnwindEntry));
+    uint8_t *dst = elf.at(vaddr, sizeof(hdr) + hdr.capacity * sizeof(AbendUnwindEntry));
+    if (NULL == dst) {
+        fprintf(stderr, "%s: abendUnwindTable is not in a loaded section\n", elf_path);
+        return 1;
+    }
+    memcpy(dst, table.data(), table.size());
+    if (! writeFile(elf_path, elf.raw)) return 1;
+    if (argc - optind == 2 && ! patchBin(argv[optind + 1], vaddr, table)) return 1;
+
+    printf("%s: %zu functions, %zu leaf, %zu not unwindable, %zu entries of %u\n",
+        elf_path, fn.size(), leaf, unknown, entry.size(), hdr.capacity);
+    if (0 == hdr.count) {
+        fprintf(stderr, "%s: table too small, build with -DABENDINFO_UNWIND_TABLE=%zu or more\n",
+            elf_path, entry.size());
+        return 1;
+    }
+    return 0;
+}